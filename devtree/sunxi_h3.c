@@ -15,6 +15,7 @@
 */
 
 #include <arch/gic.h>
+#include <arch/smp.h>
 
 #include <drivers/fs/mbr.h>
 #include <drivers/fs/fat32.h>
@@ -23,6 +24,7 @@
 #include <drivers/arm/sunxi/gpio.h>
 #include <drivers/arm/sunxi/uart.h>
 #include <drivers/arm/sunxi/timer.h>
+#include <drivers/arm/sunxi/cpucfg.h>
 
 #define VERMILLION_INTERNALS
 #include <vermillion/devtree.h>
@@ -32,6 +34,7 @@
 #include <vermillion/hal/uart.h>
 #include <vermillion/hal/timer.h>
 #include <vermillion/sys/file.h>
+#include <vermillion/sys/task.h>
 #include <vermillion/util/mem.h>
 #include <vermillion/util/types.h>
 
@@ -71,6 +74,8 @@ vrm_devtree_init(uint8_t platform, uint8_t board, uint32_t flags)
     if (ret)
     {
         mem_init();
+        task_init();
+        file_init();
         APB0_GATE = 1;
 
         switch (board)
@@ -96,6 +101,11 @@ vrm_devtree_init(uint8_t platform, uint8_t board, uint32_t flags)
         /* Interrupts */
         gic_init(0x01c82000, 0x01c81000);
 
+        /* Secondary cores */
+#ifdef CONFIG_ARM_SMP
+        smp_init(sunxi_cpucfg_boot);
+#endif
+
         /* Serial */
         uart[0] = sunxi_uart_init(0);
         BUS3_GATE  |= 1 << 17;
@@ -0,0 +1,59 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <drivers/arm/sunxi/cpucfg.h>
+
+#include <vermillion/util/types.h>
+
+#define CPUCFG 0x01F01C00
+#define CPU_RST_CTRL(n) *(volatile uint32_t*)(CPUCFG + 0x40 + (n * 0x40))
+#define GEN_CTRL        *(volatile uint32_t*)(CPUCFG + 0x184)
+#define CPU_BOOT_ADDR   *(volatile uint32_t*)(CPUCFG + 0x1A4)
+#define DBG_CTRL1       *(volatile uint32_t*)(CPUCFG + 0x1E4)
+
+#define R_PRCM 0x01F01400
+#define CPU_PWROFF      *(volatile uint32_t*)(R_PRCM + 0x100)
+#define CPU_PWR_CLAMP(n) *(volatile uint32_t*)(R_PRCM + 0x140 + (n * 4))
+
+/* Core release, same sequence as the reference PSCI firmware */
+
+extern bool
+sunxi_cpucfg_boot(uint8_t core, uint32_t entry)
+{
+    bool ret = (core > 0 && core < 4);
+
+    if (ret)
+    {
+        CPU_BOOT_ADDR = entry;
+
+        /* Holds the core in reset, with L1 invalidation on release
+         * and no external debug access meanwhile */
+        CPU_RST_CTRL(core) = 0;
+        GEN_CTRL  &= ~(1 << core);
+        DBG_CTRL1 &= ~(1 << core);
+
+        /* Opens the power clamp gradually, then removes the gating */
+        for (uint8_t i = 0; i <= 8; i++)
+            CPU_PWR_CLAMP(core) = 0xFF >> i;
+        CPU_PWROFF &= ~(1 << core);
+
+        /* Releases the core, which starts at the boot address */
+        CPU_RST_CTRL(core) = 0x3;
+        DBG_CTRL1 |= 1 << core;
+    }
+
+    return ret;
+}
@@ -61,7 +61,13 @@ alarm(void *ctx, uint32_t us, bool repeat, void (*handler)(void *), void *arg)
     TMR_INTV(tmr->base, tmr->id) = 24 * us;
     TMR_CUR(tmr->base, tmr->id) = 0;
 
-    gic_config(tmr->irq, (handler) ? callback : NULL, tmr, true, false);
+    /* Scheduler ticks come from here, so they outrank the rest;
+     * rearming with a handler already set leaves the GIC alone */
+    if (!handler != !(tmr->handler))
+    {
+        gic_config(tmr->irq, (handler) ? callback : NULL, tmr, true, false,
+                   GIC_CORE(0), GIC_PRIO_HIGH);
+    }
     tmr->handler = handler;
     tmr->arg     = arg;
 
@@ -102,6 +108,10 @@ sunxi_timer_init(uint8_t id)
         ret->id = id;
 
         ret->irq = (id == 0) ? 50 : 51;
+
+        /* The GIC is configured again on the first alarm */
+        ret->handler = NULL;
+        ret->arg     = NULL;
     }
 
     return (dev_timer){.driver = &sunxi_timer, .context = ret};
@@ -117,7 +127,9 @@ sunxi_timer_clean(dev_timer *t)
         TMR_CTRL(tmr->base, tmr->id) &= ~(1 << 0);
         TMR_IRQ_EN(tmr->base)  &= ~(1 << tmr->id);
 
-        gic_config(tmr->irq, NULL, NULL, true, false);
+        gic_config(tmr->irq, NULL, NULL, true, false, 0, 0);
+        tmr->handler = NULL;
+        tmr->arg     = NULL;
         t->context = NULL;
     }
 }
@@ -18,6 +18,7 @@
 
 #define VERMILLION_INTERNALS
 #include <vermillion/hal/uart.h>
+#include <vermillion/sys/spin.h>
 #include <vermillion/util/mem.h>
 #include <vermillion/util/types.h>
 
@@ -47,6 +48,8 @@ struct uart
 
     uint8_t irq;
 
+    /* Filled by the handler, drained by tasks on any core */
+    vrm_spin lock;
     uint8_t buffer[0x400];
     size_t head, tail;
 };
@@ -61,6 +64,7 @@ uart_handler(void *arg)
 {
     struct uart *u = arg;
 
+    vrm_spin_lock(&(u->lock));
     while (IO_LSR(u->port) & (1 << 0))
     {
         size_t next = (u->head + 1) & 0x3FF;
@@ -70,6 +74,7 @@ uart_handler(void *arg)
             u->head = next;
         }
     }
+    vrm_spin_unlock(&(u->lock));
 }
 
 static bool
@@ -130,6 +135,8 @@ read(void *ctx, uint8_t *data)
     bool ret = false;
 
     struct uart *u = ctx;
+    uint32_t flags = vrm_spin_irqsave(&(u->lock));
+
     ret = (u->head != u->tail || IO_LSR(u->port) & (1 << 0));
     if (ret)
     {
@@ -142,6 +149,8 @@ read(void *ctx, uint8_t *data)
             *data = IO_BUF(u->port);
     }
 
+    vrm_spin_irqrestore(&(u->lock), flags);
+
     return ret;
 }
 
@@ -177,7 +186,9 @@ sunxi_uart_init(uint8_t id)
         ret->port = ports[id];
 
         ret->irq = irqs[id];
-        gic_config(ret->irq, uart_handler, ret, false, true);
+        /* Handled on the boot core like the timers, readers anywhere */
+        gic_config(ret->irq, uart_handler, ret, false, true,
+                   GIC_CORE(0), GIC_PRIO_NORMAL);
 
         /* FIFOs with RX 1/2 full interrupt */
         IO_FCR(ret->port) = (1 << 7) | (1 << 0);
@@ -193,7 +204,7 @@ sunxi_uart_clean(dev_uart *u)
     if (u)
     {
         struct uart *u2 = u->context;
-        gic_config(u2->irq, NULL, NULL, false, true);
+        gic_config(u2->irq, NULL, NULL, false, true, 0, 0);
         u->context = NULL;
     }
 }
@@ -87,7 +87,7 @@ mbr_init(uint8_t id, uint8_t disk, uint8_t partition)
 
     if (ret)
     {
-        uint8_t *buffer = vrm_mem_new(ret->sector);
+        uint8_t *buffer = vrm_mem_new_flags(ret->sector, VRM_MEM_DMA);
 
         if (buffer && vrm_disk_read(disk, buffer, 0, 0))
         {
@@ -0,0 +1,28 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vermillion/util/types.h>
+
+/* All of them are full barriers */
+uint32_t vrm_atomic_load (volatile uint32_t *a);
+void     vrm_atomic_store(volatile uint32_t *a, uint32_t value);
+uint32_t vrm_atomic_add  (volatile uint32_t *a, int32_t value);
+uint32_t vrm_atomic_swap (volatile uint32_t *a, uint32_t value);
+bool     vrm_atomic_cmpxchg(volatile uint32_t *a, uint32_t *expected,
+                            uint32_t desired);
+void     vrm_atomic_barrier(void);
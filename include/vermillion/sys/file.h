@@ -56,6 +56,7 @@ struct vrm_file
     bool     flush;
 };
 
+void file_init(void);
 void file_setup(dev_fs *list, uint8_t count);
 #endif
 
@@ -0,0 +1,41 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vermillion/util/types.h>
+
+typedef struct vrm_queue vrm_queue;
+
+typedef struct
+{
+    size_t size, count;
+    /* Items held now and at most, sends and receives that gave up */
+    size_t depth, peak;
+    uint32_t sends, recvs, failed;
+} vrm_queue_info;
+
+/* Timeouts in microseconds, 0 never waits */
+#define VRM_QUEUE_FOREVER 0xFFFFFFFF
+
+/* Pointer sized items are moved as a word, so queues of pointers
+ * hand buffers over to the receiver instead of copying them */
+vrm_queue * vrm_queue_create  (size_t count, size_t size);
+vrm_queue * vrm_queue_delete  (vrm_queue *q);
+bool        vrm_queue_send    (vrm_queue *q, const void *item, uint32_t us);
+bool        vrm_queue_recv    (vrm_queue *q, void *item, uint32_t us);
+bool        vrm_queue_send_isr(vrm_queue *q, const void *item);
+void        vrm_queue_stats   (vrm_queue *q, vrm_queue_info *info);
@@ -0,0 +1,35 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vermillion/util/types.h>
+
+/* Ticket lock, next ticket on the upper half and owner on the lower */
+typedef struct
+{
+    volatile uint32_t ticket;
+} vrm_spin;
+
+#define VRM_SPIN_INIT {0}
+
+void vrm_spin_lock   (vrm_spin *s);
+bool vrm_spin_trylock(vrm_spin *s);
+void vrm_spin_unlock (vrm_spin *s);
+
+/* Also masks IRQs, for data shared with interrupt handlers */
+uint32_t vrm_spin_irqsave   (vrm_spin *s);
+void     vrm_spin_irqrestore(vrm_spin *s, uint32_t flags);
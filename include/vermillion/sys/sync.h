@@ -0,0 +1,75 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vermillion/sys/spin.h>
+#include <vermillion/sys/task.h>
+#include <vermillion/util/types.h>
+
+/* Tasks parked on an object, highest priority first */
+struct vrm_waiter;
+
+/* Sleeping lock, lending the owner the priority of its waiters */
+typedef struct
+{
+    vrm_spin lock;
+    bool locked;
+    vrm_task *owner;
+    struct vrm_waiter *waiters;
+
+    /* Acquisitions, and the ones that had to wait */
+    uint32_t locks, contended;
+} vrm_mutex;
+
+#define VRM_MUTEX_INIT {VRM_SPIN_INIT, false, NULL, NULL, 0, 0}
+
+void vrm_mutex_lock   (vrm_mutex *m);
+bool vrm_mutex_trylock(vrm_mutex *m);
+void vrm_mutex_unlock (vrm_mutex *m);
+
+/* Counting semaphore, posts are also allowed from interrupts */
+typedef struct
+{
+    vrm_spin lock;
+    uint32_t count;
+    struct vrm_waiter *waiters;
+
+    uint32_t waits, contended;
+} vrm_sem;
+
+#define VRM_SEM_INIT(n) {VRM_SPIN_INIT, (n), NULL, 0, 0}
+
+void vrm_sem_wait   (vrm_sem *s);
+bool vrm_sem_trywait(vrm_sem *s);
+void vrm_sem_post   (vrm_sem *s);
+/* Against vrm_task_clock, 0 waits for as long as it takes */
+bool vrm_sem_wait_until(vrm_sem *s, uint64_t deadline);
+
+/* Condition variable, waited on with its mutex held */
+typedef struct
+{
+    vrm_spin lock;
+    struct vrm_waiter *waiters;
+
+    uint32_t waits;
+} vrm_cond;
+
+#define VRM_COND_INIT {VRM_SPIN_INIT, NULL, 0}
+
+void vrm_cond_wait     (vrm_cond *c, vrm_mutex *m);
+void vrm_cond_signal   (vrm_cond *c);
+void vrm_cond_broadcast(vrm_cond *c);
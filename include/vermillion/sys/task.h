@@ -28,12 +28,40 @@ enum vrm_task_st
     VRM_TASK_DELETED
 };
 
+/* Scheduler flags */
+#define VRM_TASK_TICKLESS (1 << 0)
+
 vrm_task * vrm_task_create   (void (*f)(void *), void *arg, uint8_t priority);
+vrm_task * vrm_task_create_ex(void (*f)(void *), void *arg, uint8_t priority,
+                              size_t stack_size);
+/* Returns the task back if it was kept, while waiting on sync objects */
 vrm_task * vrm_task_remove   (vrm_task *t);
+vrm_task * vrm_task_self     (void);
 bool       vrm_task_block    (vrm_task *t);
 bool       vrm_task_unblock  (vrm_task *t);
 bool       vrm_task_suspend  (vrm_task *t);
 bool       vrm_task_resume   (vrm_task *t);
 bool       vrm_task_priority (vrm_task *t, uint8_t priority);
+bool       vrm_task_affinity (vrm_task *t, uint32_t cores);
 void       vrm_task_yield    (void);
+/* Peak bytes used, only measured with CONFIG_TASK_STACK_PAINT */
+size_t     vrm_task_stack_usage(vrm_task *t);
+
+/* Microseconds since boot, as deadlines are given */
+uint64_t   vrm_task_clock      (void);
+bool       vrm_task_sleep      (uint32_t us);
+bool       vrm_task_sleep_until(uint64_t deadline);
+
 void       vrm_task_scheduler(uint8_t timer, uint32_t us, uint32_t flags);
+
+#ifdef VERMILLION_INTERNALS
+void    task_init(void);
+/* Priority inheritance and timed waits, for sys/sync */
+uint8_t task_level  (vrm_task *t);
+void    task_inherit(vrm_task *t, uint8_t priority);
+void    task_hold   (vrm_task *t, bool held);
+/* Marks a task waiting on a sync object, which can't be removed then */
+bool    task_park   (vrm_task *t, bool parked);
+/* Blocks the caller without switching, unblocked by the deadline */
+bool    task_block_until(uint64_t deadline);
+#endif
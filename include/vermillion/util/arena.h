@@ -0,0 +1,27 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vermillion/util/types.h>
+
+typedef struct vrm_arena vrm_arena;
+
+vrm_arena *vrm_arena_create (size_t size);
+vrm_arena *vrm_arena_destroy(vrm_arena *a);
+
+void *vrm_arena_alloc(vrm_arena *a, size_t size);
+void  vrm_arena_reset(vrm_arena *a);
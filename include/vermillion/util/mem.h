@@ -16,16 +16,63 @@
 
 #pragma once
 
+#include <vermillion/sys/task.h>
 #include <vermillion/util/types.h>
 
+/* Hints, both give buffers of whole cache lines for the cache API,
+ * as the MMU maps memory in sections and can't exclude single buffers */
+#define VRM_MEM_DMA      (1 << 0)
+#define VRM_MEM_UNCACHED (1 << 1)
+
+typedef struct
+{
+    size_t free, total;
+    size_t largest, blocks;
+    size_t used, count, peak;
+    uint32_t allocs, frees;
+    /* Free blocks by the floor of log2(size) */
+    uint32_t histogram[32];
+} vrm_mem_info;
+
+/* Owner fields are only filled with CONFIG_MEM_TRACE */
+typedef struct
+{
+    void *mem;
+    size_t size;
+
+    vrm_task *task;
+    void *caller;
+    uint64_t time;
+} vrm_mem_block;
+
+enum vrm_mem_key
+{
+    VRM_MEM_BY_TASK,
+    VRM_MEM_BY_CALLER
+};
+
+typedef struct
+{
+    const void *key;
+    size_t bytes, count;
+} vrm_mem_group;
+
 #ifdef VERMILLION_INTERNALS
 void mem_init(void);
 void mem_clean(void);
 #endif
 
 void *vrm_mem_new(size_t size);
+void *vrm_mem_new_aligned(size_t size, size_t align);
+void *vrm_mem_new_flags(size_t size, uint32_t flags);
 void *vrm_mem_del(void *mem);
+void *vrm_mem_resize(void *mem, size_t size);
 void  vrm_mem_use(size_t *free, size_t *total);
+void  vrm_mem_stats(vrm_mem_info *info);
+/* The callback runs with the heap locked, and can't allocate */
+void  vrm_mem_walk(bool (*f)(const vrm_mem_block *, void *), void *arg);
+size_t vrm_mem_aggregate(vrm_mem_group *groups, size_t count,
+                         enum vrm_mem_key key);
 
 int   vrm_mem_comp(const void *mem, const void *mem2, size_t length);
 void *vrm_mem_find(const void *mem, uint8_t c,        size_t length);
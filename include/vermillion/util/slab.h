@@ -0,0 +1,32 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vermillion/util/types.h>
+
+typedef struct vrm_slab vrm_slab;
+
+vrm_slab *vrm_slab_create (const char *name, size_t size, size_t align);
+vrm_slab *vrm_slab_destroy(vrm_slab *s);
+
+void *vrm_slab_alloc(vrm_slab *s);
+void *vrm_slab_free (vrm_slab *s, void *obj);
+
+vrm_slab *vrm_slab_walk(vrm_slab *s);
+bool      vrm_slab_stat(vrm_slab *s, const char **name, size_t *size,
+                        size_t *used, size_t *total,
+                        uint32_t *hits, uint32_t *misses);
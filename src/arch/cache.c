@@ -0,0 +1,185 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <arch/cache.h>
+
+#include <vermillion/util/types.h>
+
+enum cache_op
+{
+    CACHE_CLEAN,
+    CACHE_INVALIDATE,
+    CACHE_FLUSH
+};
+
+/* Operations by virtual address, to the point of coherency */
+
+static inline void
+cache_mva(enum cache_op op, uint32_t mva)
+{
+    switch (op)
+    {
+        case CACHE_CLEAN:
+            __asm__ __volatile__ ("mcr p15, 0, %0, c7, c10, 1" :: "r"(mva));
+            break;
+        case CACHE_INVALIDATE:
+            __asm__ __volatile__ ("mcr p15, 0, %0, c7, c6, 1"  :: "r"(mva));
+            break;
+        case CACHE_FLUSH:
+            __asm__ __volatile__ ("mcr p15, 0, %0, c7, c14, 1" :: "r"(mva));
+            break;
+    }
+}
+
+static void
+cache_range(enum cache_op op, uint32_t addr, size_t size)
+{
+    if (size)
+    {
+        uint32_t line  = vrm_cache_line();
+        uint32_t start = addr & ~(line - 1);
+        uint32_t end   = addr + size;
+
+        /* Partial lines at the edges may hold unrelated data,
+         * so they are cleaned as well instead of discarded */
+        if (op == CACHE_INVALIDATE)
+        {
+            if (start != addr)
+            {
+                cache_mva(CACHE_FLUSH, start);
+                start += line;
+            }
+            if (end & (line - 1) && start < end)
+            {
+                end &= ~(line - 1);
+                cache_mva(CACHE_FLUSH, end);
+            }
+        }
+
+        for (uint32_t mva = start; mva < end; mva += line)
+            cache_mva(op, mva);
+
+        __asm__ __volatile__ ("dsb sy");
+    }
+}
+
+/* Operations by set/way, on every data or unified level */
+
+static inline void
+cache_sw(enum cache_op op, uint32_t sw)
+{
+    switch (op)
+    {
+        case CACHE_CLEAN:
+            __asm__ __volatile__ ("mcr p15, 0, %0, c7, c10, 2" :: "r"(sw));
+            break;
+        case CACHE_INVALIDATE:
+            __asm__ __volatile__ ("mcr p15, 0, %0, c7, c6, 2"  :: "r"(sw));
+            break;
+        case CACHE_FLUSH:
+            __asm__ __volatile__ ("mcr p15, 0, %0, c7, c14, 2" :: "r"(sw));
+            break;
+    }
+}
+
+static void
+cache_all(enum cache_op op)
+{
+    uint32_t clidr = 0;
+    __asm__ __volatile__ ("mrc p15, 1, %0, c0, c0, 1" : "=r"(clidr));
+
+    for (uint8_t level = 0; level < 7; level++)
+    {
+        uint8_t type = (clidr >> (level * 3)) & 0x7;
+        if (type == 0)
+            break;
+        else if (type < 2)
+            continue;
+
+        uint32_t ccsidr = 0;
+        __asm__ __volatile__ ("mcr p15, 2, %0, c0, c0, 0"
+                              :: "r"(level << 1));
+        __asm__ __volatile__ ("isb");
+        __asm__ __volatile__ ("mrc p15, 1, %0, c0, c0, 0" : "=r"(ccsidr));
+
+        uint8_t  line = (ccsidr & 0x7) + 4;
+        uint32_t ways = (ccsidr >> 3)  & 0x3FF;
+        uint32_t sets = (ccsidr >> 13) & 0x7FFF;
+        uint8_t shift = (ways) ? __builtin_clz(ways) : 0;
+
+        for (uint32_t way = 0; way <= ways; way++)
+        {
+            for (uint32_t set = 0; set <= sets; set++)
+                cache_sw(op, (way << shift) | (set << line) | (level << 1));
+        }
+    }
+
+    __asm__ __volatile__ ("dsb sy");
+}
+
+/* External functions */
+
+extern size_t
+vrm_cache_line(void)
+{
+    static size_t line = 0;
+
+    if (!line)
+    {
+        /* Smallest data cache line, in words */
+        uint32_t ctr = 0;
+        __asm__ __volatile__ ("mrc p15, 0, %0, c0, c0, 1" : "=r"(ctr));
+        line = 4 << ((ctr >> 16) & 0xF);
+    }
+
+    return line;
+}
+
+extern void
+vrm_cache_clean(const void *addr, size_t size)
+{
+    cache_range(CACHE_CLEAN, (uint32_t)addr, size);
+}
+
+extern void
+vrm_cache_invalidate(void *addr, size_t size)
+{
+    cache_range(CACHE_INVALIDATE, (uint32_t)addr, size);
+}
+
+extern void
+vrm_cache_flush(const void *addr, size_t size)
+{
+    cache_range(CACHE_FLUSH, (uint32_t)addr, size);
+}
+
+extern void
+vrm_cache_clean_all(void)
+{
+    cache_all(CACHE_CLEAN);
+}
+
+extern void
+vrm_cache_invalidate_all(void)
+{
+    cache_all(CACHE_INVALIDATE);
+}
+
+extern void
+vrm_cache_flush_all(void)
+{
+    cache_all(CACHE_FLUSH);
+}
@@ -0,0 +1,29 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vermillion/util/types.h>
+
+size_t vrm_cache_line(void);
+
+void vrm_cache_clean     (const void *addr, size_t size);
+void vrm_cache_invalidate(void *addr,       size_t size);
+void vrm_cache_flush     (const void *addr, size_t size);
+
+void vrm_cache_clean_all(void);
+void vrm_cache_invalidate_all(void);
+void vrm_cache_flush_all(void);
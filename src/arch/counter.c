@@ -0,0 +1,71 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <arch/counter.h>
+
+#include <vermillion/util/types.h>
+
+/* ARM generic timer, physical count */
+
+/* What the H3 ships with, for firmware that doesn't set CNTFRQ */
+#define COUNTER_FREQ 24000000
+
+extern uint32_t
+counter_freq(void)
+{
+    uint32_t ret = 0;
+
+    __asm__ __volatile__ ("mrc p15, 0, %0, c14, c0, 0" : "=r"(ret));
+    if (ret == 0)
+        ret = COUNTER_FREQ;
+
+    return ret;
+}
+
+extern uint64_t
+counter_read(void)
+{
+    uint64_t ret = 0;
+
+    /* Orders the read against earlier instructions */
+    __asm__ __volatile__ ("isb");
+    __asm__ __volatile__ ("mrrc p15, 0, %Q0, %R0, c14" : "=r"(ret));
+
+    return ret;
+}
+
+extern uint64_t
+counter_us(void)
+{
+    uint64_t ret = 0;
+
+    /* Long division in 16-bit steps, which keeps to 32-bit divides
+     * without libgcc, exact for rates in whole MHz */
+    uint32_t div = counter_freq() / 1000000;
+    uint64_t count = counter_read();
+    uint32_t parts[4] = {(count >> 48) & 0xFFFF, (count >> 32) & 0xFFFF,
+                         (count >> 16) & 0xFFFF, count & 0xFFFF};
+
+    uint32_t rem = 0;
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        uint32_t part = (rem << 16) | parts[i];
+        ret = (ret << 16) | (part / div);
+        rem = part % div;
+    }
+
+    return ret;
+}
@@ -15,7 +15,9 @@
 */
 
 #include <arch/gic.h>
+#include <arch/smp.h>
 
+#include <vermillion/sys/spin.h>
 #include <vermillion/util/mem.h>
 #include <vermillion/util/debug.h>
 #include <vermillion/util/types.h>
@@ -51,6 +53,15 @@ extern void *__ivt[8];
 #define ICDIPR(dist, n)  *(volatile uint32_t*)(dist + 0x400 + (n * 4))
 #define ICDIPTR(dist, n) *(volatile uint32_t*)(dist + 0x800 + (n * 4))
 #define ICDICFR(dist, n) *(volatile uint32_t*)(dist + 0xC00 + (n * 4))
+#define ICDSGIR(dist)    *(volatile uint32_t*)(dist + 0xF00)
+
+/* Software generated interrupts, banked per core */
+#define SGI_COUNT    16
+#define SGI_PRIORITY GIC_PRIO_NORMAL
+
+#define SGI_LIST   (0 << 24)
+#define SGI_OTHERS (1 << 24)
+#define SGI_SELF   (2 << 24)
 
 /* Driver definition */
 
@@ -59,9 +70,7 @@ enum intr_core
     INTR_CORE0 = 0,
     INTR_CORE1,
     INTR_CORE2,
-    INTR_CORE3,
-
-    INTR_CORE_NONE = 255
+    INTR_CORE3
 };
 
 static inline uint16_t
@@ -145,14 +154,13 @@ gic_intr_activity(uint32_t dist, uint16_t n, bool enable)
 }
 
 static inline void
-gic_intr_target(uint32_t dist, uint16_t n, enum intr_core c)
+gic_intr_target(uint32_t dist, uint16_t n, uint8_t cores)
 {
     uint8_t reg = n / 4;
     uint8_t off = n % 4;
 
     ICDIPTR(dist, reg) &= ~(0xFF << (off * 8));
-    if (c != INTR_CORE_NONE)
-        ICDIPTR(dist, reg) |= (1 << ((off * 8) + c));
+    ICDIPTR(dist, reg) |= cores << (off * 8);
 }
 
 static inline void
@@ -161,8 +169,8 @@ gic_intr_priority(uint32_t dist, uint16_t n, uint8_t priority)
     uint8_t reg = n / 4;
     uint8_t off = n % 4;
 
-    ICDIPTR(dist, reg) &= ~(0xFF << (off * 8));
-    ICDIPTR(dist, reg) |= priority << (off * 8);
+    ICDIPR(dist, reg) &= ~(0xFF << (off * 8));
+    ICDIPR(dist, reg) |= priority << (off * 8);
 }
 
 static inline void
@@ -180,8 +188,15 @@ struct gic
     bool enabled;
     uint32_t cpu, dist;
 
+    /* Distributor registers are shared by several interrupts each */
+    vrm_spin lock;
+
     void (*handler[256])(void *), *arg[256];
-    uint8_t stack[CONFIG_STACK_SIZE];
+    uint8_t stack[SMP_CORES][CONFIG_STACK_SIZE];
+
+    /* Supervisor calls, once the cores leave that mode to them */
+    void (*svc)(void *), *svc_arg;
+    uint8_t svc_stack[SMP_CORES][CONFIG_STACK_SIZE];
 };
 
 static struct gic gic = {0};
@@ -193,13 +208,6 @@ INTERRUPT(undef) handler_undef(void)
         arm_wait_interrupts();
 }
 
-INTERRUPT(swi) handler_swi(void)
-{
-    vrm_debug("Unhandled supervisor call");
-    for (;;)
-        arm_wait_interrupts();
-}
-
 INTERRUPT(abort) handler_prefetch(void)
 {
     vrm_debug("Prefetch Abort");
@@ -214,19 +222,24 @@ INTERRUPT(abort) handler_data(void)
         arm_wait_interrupts();
 }
 
+uint32_t *gic_irq_regs[SMP_CORES];
+
 static void
-handler_irq_c(void)
+handler_irq_c(uint32_t *regs)
 {
+    gic_irq_regs[smp_core()] = regs;
+
     enum intr_core c = 0;
 
+    /* Spurious IDs from 1020 up are neither acknowledged nor handled */
     uint16_t n = intr_info(gic.cpu, &c);
-    intr_ack(gic.cpu, c, n);
+    if (n < 1020)
+        intr_ack(gic.cpu, c, n);
 
-    if (gic.handler[n])
+    if (n < 256 && gic.handler[n])
         gic.handler[n](gic.arg[n]);
 }
 
-uint32_t *gic_irq_regs;
 __attribute__((naked))
 INTERRUPT(irq) handler_irq(void)
 {
@@ -239,9 +252,9 @@ INTERRUPT(irq) handler_irq(void)
     __asm__ __volatile__ ("add sp, sp, #4");
     __asm__ __volatile__ ("mrs r0, spsr");
     __asm__ __volatile__ ("str r0, [sp]");
-    /* Saves sp address */
+    /* Passes the saved registers of this core */
     __asm__ __volatile__ ("sub sp, sp, #64");
-    __asm__ __volatile__ ("mov %0, sp" : "=r"(gic_irq_regs));
+    __asm__ __volatile__ ("mov r0, sp");
 
     /* Branches to C handler */
     (void)handler_irq_c;
@@ -261,6 +274,50 @@ INTERRUPT(irq) handler_irq(void)
     __asm__ __volatile__ ("subs pc, lr, #4");
 }
 
+static void
+handler_swi_c(uint32_t *regs)
+{
+    gic_irq_regs[smp_core()] = regs;
+
+    if (gic.svc)
+        gic.svc(gic.svc_arg);
+    else
+    {
+        vrm_debug("Unhandled supervisor call");
+        for (;;)
+            arm_wait_interrupts();
+    }
+}
+
+__attribute__((naked))
+INTERRUPT(swi) handler_swi(void)
+{
+    /* Same frame as the IRQ handler, so either can switch tasks */
+    __asm__ __volatile__ ("sub sp, sp, #4");
+    /* Returns past the call, with the IRQ offset added */
+    __asm__ __volatile__ ("add lr, lr, #4");
+    __asm__ __volatile__ ("stmdb sp!, {lr}");
+    __asm__ __volatile__ ("stmdb sp, {r0-r14}^");
+    __asm__ __volatile__ ("add sp, sp, #4");
+    __asm__ __volatile__ ("mrs r0, spsr");
+    __asm__ __volatile__ ("str r0, [sp]");
+    __asm__ __volatile__ ("sub sp, sp, #64");
+    __asm__ __volatile__ ("mov r0, sp");
+
+    (void)handler_swi_c;
+    __asm__ __volatile__ ("bl handler_swi_c");
+
+    __asm__ __volatile__ ("ldmia sp, {r0-r14}^");
+    __asm__ __volatile__ ("add sp, sp, #60");
+    __asm__ __volatile__ ("ldmia sp!, {lr}");
+    __asm__ __volatile__ ("ldmia sp!, {r0}");
+    __asm__ __volatile__ ("msr spsr_fsxc, r0");
+    __asm__ __volatile__ ("ldr r0, [sp, #-68]");
+    __asm__ __volatile__ ("dsb sy");
+    __asm__ __volatile__ ("isb");
+    __asm__ __volatile__ ("subs pc, lr, #4");
+}
+
 INTERRUPT(fiq) handler_fiq(void)
 {
     vrm_debug("Unexpected FIQ");
@@ -283,7 +340,13 @@ gic_init(uint32_t cpu, uint32_t dist)
     __ivt[IVT_IRQ]      = handler_irq;
     __ivt[IVT_FIQ]      = handler_fiq;
 
-    void *addr = &(gic.stack[CONFIG_STACK_SIZE]);
+    gic_init_core();
+}
+
+extern void
+gic_init_core(void)
+{
+    void *addr = &(gic.stack[smp_core()][CONFIG_STACK_SIZE]);
     __asm__ __volatile__ ("msr CPSR_c, #0b11010010\n"
                           "mov sp, %0\n"
                           "msr CPSR_c, #0b11010011\n"
@@ -291,7 +354,13 @@ gic_init(uint32_t cpu, uint32_t dist)
                           : "r"(addr)
                           : "memory");
 
+    /* Enable and rank the SGIs of this core */
+    ICDISER(gic.dist, 0) = (1 << SGI_COUNT) - 1;
+    for (uint8_t i = 0; i < SGI_COUNT / 4; i++)
+        ICDIPR(gic.dist, i) = SGI_PRIORITY * 0x01010101U;
+
     gic_priority(gic.cpu, 0xFF);
+    gic_enable(gic.cpu);
 }
 
 extern void
@@ -329,18 +398,51 @@ gic_state(bool enabled)
 }
 
 extern void
-gic_config(uint8_t n, void (*handler)(void *), void *arg, bool edge, bool high)
+gic_system(void)
 {
-    if (gic.enabled)
-    {
-        arm_disable_irq();
-        gic_disable_dist(gic.dist);
-        gic_disable(gic.cpu);
-    }
+    /* The caller goes on in system mode, with the same stack and return
+     * address, so a supervisor call can't clobber its banked registers */
+    void *addr = &(gic.svc_stack[smp_core()][CONFIG_STACK_SIZE]);
+    __asm__ __volatile__ ("mov r1, sp\n"
+                          "mov r2, lr\n"
+                          "cps #0x1F\n"
+                          "mov sp, r1\n"
+                          "mov lr, r2\n"
+                          "cps #0x13\n"
+                          "mov sp, %0\n"
+                          "cps #0x1F\n"
+                          :
+                          : "r"(addr)
+                          : "r1", "r2", "lr", "memory");
+}
+
+extern void
+gic_svc_handler(void (*handler)(void *), void *arg)
+{
+    gic.svc_arg = arg;
+    gic.svc     = handler;
+}
+
+extern void
+gic_config(uint8_t n, void (*handler)(void *), void *arg,
+           bool edge, bool high, uint8_t cores, uint8_t priority)
+{
+    /* Cores not up yet would leave the interrupt pending forever */
+    uint8_t online = 0;
+    for (uint8_t i = 0; i < SMP_CORES; i++)
+        online |= (smp_online(i)) ? (1 << i) : 0;
+
+    cores &= online;
+    if (!cores)
+        cores = 1 << smp_core();
+
+    /* Only this interrupt is held off while it changes, and the caller
+     * keeps its IRQ state, as it may be holding locks of its own */
+    uint32_t flags = vrm_spin_irqsave(&(gic.lock));
 
-    gic_intr_target(gic.dist, n, INTR_CORE_NONE);
     gic_intr_activity(gic.dist, n, false);
-    gic_intr_priority(gic.dist, n, 0);
+    gic_intr_target(gic.dist, n, 0);
+    gic_intr_priority(gic.dist, n, priority);
     gic_intr_sensitivity(gic.dist, n, edge, high);
 
     gic.handler[n] = handler;
@@ -348,18 +450,50 @@ gic_config(uint8_t n, void (*handler)(void *), void *arg, bool edge, bool high)
 
     if (handler)
     {
+        gic_intr_target(gic.dist, n, cores);
         gic_intr_activity(gic.dist, n, true);
-        gic_intr_target(gic.dist, n, gic.cpu);
     }
 
-    if (gic.enabled)
+    vrm_spin_irqrestore(&(gic.lock), flags);
+}
+
+extern void
+gic_sgi_handler(uint8_t n, void (*handler)(void *), void *arg)
+{
+    if (n < SGI_COUNT)
     {
-        gic_enable(gic.cpu);
-        gic_enable_dist(gic.dist);
-        arm_enable_irq();
+        gic.arg    [n] = arg;
+        gic.handler[n] = handler;
     }
 }
 
+static void
+gic_sgi(uint32_t filter, uint8_t cores, uint8_t n)
+{
+    /* Handler and arguments visible before the interrupt */
+    __asm__ __volatile__ ("dsb ish" ::: "memory");
+    ICDSGIR(gic.dist) = filter | (cores << 16) | (n & 0xF);
+}
+
+extern void
+gic_sgi_core(uint8_t n, uint8_t core)
+{
+    gic_sgi(SGI_LIST, 1 << core, n);
+}
+
+extern void
+gic_sgi_mask(uint8_t n, uint8_t cores)
+{
+    if (cores)
+        gic_sgi(SGI_LIST, cores, n);
+}
+
+extern void
+gic_sgi_others(uint8_t n)
+{
+    gic_sgi(SGI_OTHERS, 0, n);
+}
+
 extern void
 gic_wait(void)
 {
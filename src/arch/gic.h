@@ -16,13 +16,32 @@
 
 #pragma once
 
+#include <arch/smp.h>
+
 #include <vermillion/util/types.h>
 
-extern uint32_t *gic_irq_regs;
+/* Registers saved by the IRQ or SVC handler running on each core */
+extern uint32_t *gic_irq_regs[SMP_CORES];
 
 void gic_init(uint32_t cpu, uint32_t dist);
+void gic_init_core(void);
 void gic_clean(void);
 void gic_state(bool enabled);
+void gic_system(void);
+void gic_svc_handler(void (*handler)(void *), void *arg);
+/* Lower values preempt higher ones, SGIs sit at the normal level */
+#define GIC_PRIO_HIGH   0x40
+#define GIC_PRIO_NORMAL 0x80
+#define GIC_PRIO_LOW    0xC0
+
+#define GIC_CORE(n)   (1 << (n))
+#define GIC_CORES_ALL ((1 << SMP_CORES) - 1)
+
 void gic_config(uint8_t n, void (*handler)(void *), void *arg,
-                bool edge, bool high);
+                bool edge, bool high, uint8_t cores, uint8_t priority);
 void gic_wait(void);
+
+void gic_sgi_handler(uint8_t n, void (*handler)(void *), void *arg);
+void gic_sgi_core  (uint8_t n, uint8_t core);
+void gic_sgi_mask  (uint8_t n, uint8_t cores);
+void gic_sgi_others(uint8_t n);
@@ -0,0 +1,125 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <arch/mmu.h>
+#include <arch/cache.h>
+
+#include <vermillion/util/types.h>
+
+/* Short descriptor format, 1MiB sections */
+
+#define SECTION_SIZE 0x100000
+
+#define SECT_TYPE   (0x2 << 0)
+#define SECT_B      (1 << 2)
+#define SECT_C      (1 << 3)
+#define SECT_XN     (1 << 4)
+#define SECT_AP_RW  (0x3 << 10)
+#define SECT_TEX(x) ((x) << 12)
+#define SECT_S      (1 << 16)
+
+/* Normal memory, write-back write-allocate, shareable */
+#define SECT_NORMAL (SECT_TYPE | SECT_AP_RW | SECT_TEX(1) | \
+                     SECT_C | SECT_B | SECT_S)
+/* Shareable device memory, never executed */
+#define SECT_DEVICE (SECT_TYPE | SECT_AP_RW | SECT_B | SECT_XN)
+
+/* Table walks are inner/outer write-back write-allocate, shareable */
+#define TTBR_FLAGS ((1 << 6) | (1 << 3) | (1 << 1))
+
+#define SCTLR_M (1 << 0)
+#define SCTLR_C (1 << 2)
+#define SCTLR_Z (1 << 11)
+#define SCTLR_I (1 << 12)
+#define SCTLR_TRE (1 << 28)
+#define SCTLR_AFE (1 << 29)
+
+#define ACTLR_SMP (1 << 6)
+
+/* Unmapped sections fault, which also catches null dereferences */
+static uint32_t mmu_table[4096] __attribute__((aligned(0x4000))) = {0};
+
+static void
+mmu_section(uint32_t addr, uint32_t size, uint32_t attr)
+{
+    uint32_t first = addr / SECTION_SIZE;
+    uint32_t count = (size + SECTION_SIZE - 1) / SECTION_SIZE;
+
+    for (uint32_t i = first; i < first + count && i < 4096; i++)
+        mmu_table[i] = (i * SECTION_SIZE) | attr;
+}
+
+static void
+mmu_enable(void)
+{
+    /* Cortex-A7 requires SMP to be set for the caches to be coherent */
+    uint32_t actlr = 0;
+    __asm__ __volatile__ ("mrc p15, 0, %0, c1, c0, 1" : "=r"(actlr));
+    actlr |= ACTLR_SMP;
+    __asm__ __volatile__ ("mcr p15, 0, %0, c1, c0, 1" :: "r"(actlr));
+
+    /* Only TTBR0 is used, with domain 0 as client */
+    __asm__ __volatile__ ("mcr p15, 0, %0, c2, c0, 2" :: "r"(0));
+    __asm__ __volatile__ ("mcr p15, 0, %0, c2, c0, 0"
+                          :: "r"((uint32_t)mmu_table | TTBR_FLAGS));
+    __asm__ __volatile__ ("mcr p15, 0, %0, c3, c0, 0" :: "r"(0x1));
+    __asm__ __volatile__ ("isb");
+
+    /* MMU, L1 I/D caches, L2 (through SCTLR.C) and branch prediction */
+    uint32_t sctlr = 0;
+    __asm__ __volatile__ ("mrc p15, 0, %0, c1, c0, 0" : "=r"(sctlr));
+    sctlr &= ~(SCTLR_TRE | SCTLR_AFE);
+    sctlr |= SCTLR_M | SCTLR_C | SCTLR_Z | SCTLR_I;
+    __asm__ __volatile__ ("mcr p15, 0, %0, c1, c0, 0" :: "r"(sctlr));
+    __asm__ __volatile__ ("isb");
+}
+
+static void
+mmu_local(void)
+{
+    /* Instruction cache, branch predictor and TLB of this core */
+    __asm__ __volatile__ ("mcr p15, 0, %0, c7, c5, 0" :: "r"(0));
+    __asm__ __volatile__ ("mcr p15, 0, %0, c7, c5, 6" :: "r"(0));
+    __asm__ __volatile__ ("mcr p15, 0, %0, c8, c7, 0" :: "r"(0));
+    __asm__ __volatile__ ("dsb sy");
+    __asm__ __volatile__ ("isb");
+}
+
+/* For boot usage */
+
+extern void
+mmu_init(void)
+{
+    mmu_section(CONFIG_RAM_ADDRESS, CONFIG_RAM_SIZE, SECT_NORMAL);
+    mmu_section(CONFIG_IO_ADDRESS,  CONFIG_IO_SIZE,  SECT_DEVICE);
+
+    /* u-boot hands over with the MMU and caches disabled,
+     * so their contents are stale and only need invalidation */
+    vrm_cache_invalidate_all();
+    mmu_local();
+
+    mmu_enable();
+}
+
+extern void
+mmu_init_secondary(void)
+{
+    /* The table is already built, and Cortex-A7 invalidates its caches
+     * on reset; a set/way pass here would discard the shared L2 */
+    mmu_local();
+
+    mmu_enable();
+}
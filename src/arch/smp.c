@@ -0,0 +1,203 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <arch/smp.h>
+#include <arch/cache.h>
+#include <arch/gic.h>
+#ifdef CONFIG_ARM_COUNTER
+#include <arch/counter.h>
+#endif
+
+#include <vermillion/sys/spin.h>
+#include <vermillion/util/types.h>
+
+/* Boot stacks of the secondary cores, core n uses slot n - 1 */
+uint8_t smp_stacks[SMP_CORES - 1][CONFIG_STACK_SIZE]
+    __attribute__((aligned(8)));
+
+extern void __secondary(void);
+
+/* Each entry is only written by its own core, or the boot core for 0 */
+static volatile bool online[SMP_CORES] = {true};
+
+/* Work handed to an idle core */
+
+struct mailbox
+{
+    void (*volatile f)(void *);
+    void *volatile arg;
+
+    /* Serializes the callers posting to the same core */
+    vrm_spin lock;
+};
+
+static struct mailbox mailboxes[SMP_CORES] = {0};
+
+static bool
+smp_take(uint8_t core)
+{
+    struct mailbox *mb = &(mailboxes[core]);
+
+    void (*f)(void *) = mb->f;
+    if (f)
+    {
+        void *arg = mb->arg;
+        __asm__ __volatile__ ("dmb sy" ::: "memory");
+        mb->f = NULL;
+
+        __asm__ __volatile__ ("dsb sy");
+        __asm__ __volatile__ ("sev");
+        f(arg);
+    }
+
+    return (f != NULL);
+}
+
+static void
+smp_idle(uint8_t core)
+{
+    /* Polled with IRQs masked, until a call makes the core schedule */
+    while (true)
+    {
+        if (!smp_take(core))
+            __asm__ __volatile__ ("wfe");
+    }
+}
+
+/* Interrupt handlers */
+
+static void
+smp_mailbox(void *arg)
+{
+    (void)arg;
+    smp_take(smp_core());
+}
+
+static volatile uint32_t pongs[SMP_CORES] = {0};
+
+static void
+smp_pong(void *arg)
+{
+    (void)arg;
+    pongs[smp_core()]++;
+}
+
+/* For boot usage */
+
+extern void
+smp_main(void)
+{
+    uint8_t core = smp_core();
+
+#ifdef CONFIG_ARM_GIC
+    gic_init_core();
+#endif
+
+    online[core] = true;
+    __asm__ __volatile__ ("dsb sy");
+    __asm__ __volatile__ ("sev");
+
+    smp_idle(core);
+}
+
+/* For internal usage */
+
+extern uint8_t
+smp_core(void)
+{
+    uint32_t mpidr = 0;
+    __asm__ __volatile__ ("mrc p15, 0, %0, c0, c0, 5" : "=r"(mpidr));
+    return mpidr & 0x3;
+}
+
+extern bool
+smp_online(uint8_t core)
+{
+    return core < SMP_CORES && online[core];
+}
+
+extern void
+smp_init(bool (*release)(uint8_t core, uint32_t entry))
+{
+    gic_sgi_handler(SMP_SGI_CALL, smp_mailbox, NULL);
+    gic_sgi_handler(SMP_SGI_PING, smp_pong, NULL);
+
+    /* Secondaries start with their caches off and read memory directly */
+#ifdef CONFIG_ARM_MMU
+    vrm_cache_clean_all();
+#endif
+
+    for (uint8_t i = 1; i < SMP_CORES; i++)
+    {
+        /* Spins, as wfe would hang on a core that never comes up */
+        if (release && release(i, (uint32_t)__secondary))
+        {
+            for (uint32_t j = 0; !(online[i]) && j < 0x1000000; j++);
+        }
+    }
+}
+
+extern bool
+smp_call(uint8_t core, void (*f)(void *), void *arg)
+{
+    bool ret = false;
+
+    /* Waits for an earlier call to be taken before posting */
+    if (f && core != smp_core() && smp_online(core))
+    {
+        struct mailbox *mb = &(mailboxes[core]);
+        vrm_spin_lock(&(mb->lock));
+        while (mb->f)
+            __asm__ __volatile__ ("wfe");
+
+        mb->arg = arg;
+        __asm__ __volatile__ ("dmb sy" ::: "memory");
+        mb->f = f;
+        vrm_spin_unlock(&(mb->lock));
+
+        /* For cores already scheduling, which no longer poll */
+        gic_sgi_core(SMP_SGI_CALL, core);
+        ret = true;
+    }
+
+    return ret;
+}
+
+#ifdef CONFIG_ARM_COUNTER
+extern bool
+smp_ping(uint8_t core, uint32_t *ns)
+{
+    bool ret = false;
+
+    /* The target has to be taking interrupts, as scheduling cores do */
+    if (core != smp_core() && smp_online(core))
+    {
+        uint32_t seen = pongs[core];
+
+        uint64_t start = counter_read();
+        gic_sgi_core(SMP_SGI_PING, core);
+        for (uint32_t i = 0; pongs[core] == seen && i < 0x1000000; i++);
+        uint64_t end = counter_read();
+
+        ret = (pongs[core] != seen);
+        if (ret && ns)
+            *ns = (uint32_t)(end - start) * 1000 /
+                  (counter_freq() / 1000000);
+    }
+
+    return ret;
+}
+#endif
@@ -0,0 +1,43 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vermillion/util/types.h>
+
+#ifdef CONFIG_ARM_SMP
+#define SMP_CORES CONFIG_SMP_CORES
+#else
+#define SMP_CORES 1
+#endif
+
+/* Software generated interrupts in use */
+#define SMP_SGI_CALL    0
+#define SMP_SGI_RESCHED 1
+#define SMP_SGI_PING    2
+
+#ifdef CONFIG_ARM_SMP
+uint8_t smp_core(void);
+bool    smp_online(uint8_t core);
+void    smp_init(bool (*release)(uint8_t core, uint32_t entry));
+bool    smp_call(uint8_t core, void (*f)(void *), void *arg);
+#ifdef CONFIG_ARM_COUNTER
+bool    smp_ping(uint8_t core, uint32_t *ns);
+#endif
+#else
+#define smp_core() 0
+#define smp_online(core) ((core) == 0)
+#endif
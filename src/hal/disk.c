@@ -14,6 +14,8 @@
  *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <arch/cache.h>
+
 #define VERMILLION_INTERNALS
 #include <vermillion/hal/disk.h>
 #include <vermillion/util/types.h>
@@ -57,6 +59,15 @@ extern bool
 vrm_disk_read(uint8_t id, uint8_t *data, uint32_t block, uint32_t flags)
 {
     (void)flags;
+
+#ifdef CONFIG_ARM_MMU
+    /* No dirty line can be evicted over what the device writes; the
+     * drivers copy through the cache, so nothing is dropped after */
+    uint16_t sector = 0;
+    if (vrm_disk_size(id, &sector, NULL))
+        vrm_cache_flush(data, sector);
+#endif
+
     return DISK_CALL(read, data, block);
 }
 
@@ -64,5 +75,12 @@ extern bool
 vrm_disk_write(uint8_t id, uint8_t *data, uint32_t block, uint32_t flags)
 {
     (void)flags;
+
+#ifdef CONFIG_ARM_MMU
+    uint16_t sector = 0;
+    if (vrm_disk_size(id, &sector, NULL))
+        vrm_cache_clean(data, sector);
+#endif
+
     return DISK_CALL(write, data, block);
 }
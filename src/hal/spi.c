@@ -14,6 +14,8 @@
  *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <arch/cache.h>
+
 #define VERMILLION_INTERNALS
 #include <vermillion/hal/spi.h>
 #include <vermillion/util/types.h>
@@ -69,6 +71,12 @@ vrm_spi_transfer(uint8_t id, uint8_t *data, size_t count, uint32_t flags)
 {
     bool ret = false;
 
+#ifdef CONFIG_ARM_MMU
+    /* Data goes out of and comes back into the same buffer, copied
+     * by the driver through the cache, so nothing is dropped after */
+    vrm_cache_flush(data, count);
+#endif
+
     if (flags & VRM_SPI_NOWAIT)
         ret = SPI_CALL(transfer, data, count, flags);
     else
@@ -0,0 +1,108 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <vermillion/sys/atomic.h>
+#include <vermillion/util/types.h>
+
+/* Exclusive accesses, inner shareable as all the cores are */
+
+extern void
+vrm_atomic_barrier(void)
+{
+    __asm__ __volatile__ ("dmb ish" ::: "memory");
+}
+
+extern uint32_t
+vrm_atomic_load(volatile uint32_t *a)
+{
+    vrm_atomic_barrier();
+    uint32_t ret = *a;
+    vrm_atomic_barrier();
+
+    return ret;
+}
+
+extern void
+vrm_atomic_store(volatile uint32_t *a, uint32_t value)
+{
+    vrm_atomic_barrier();
+    *a = value;
+    vrm_atomic_barrier();
+}
+
+extern uint32_t
+vrm_atomic_add(volatile uint32_t *a, int32_t value)
+{
+    uint32_t ret = 0, fail = 0;
+
+    vrm_atomic_barrier();
+    __asm__ __volatile__ ("1: ldrex %0, [%2]\n"
+                          "   add   %0, %0, %3\n"
+                          "   strex %1, %0, [%2]\n"
+                          "   cmp   %1, #0\n"
+                          "   bne   1b\n"
+                          : "=&r"(ret), "=&r"(fail)
+                          : "r"(a), "r"(value)
+                          : "memory", "cc");
+    vrm_atomic_barrier();
+
+    return ret;
+}
+
+extern uint32_t
+vrm_atomic_swap(volatile uint32_t *a, uint32_t value)
+{
+    uint32_t ret = 0, fail = 0;
+
+    vrm_atomic_barrier();
+    __asm__ __volatile__ ("1: ldrex %0, [%2]\n"
+                          "   strex %1, %3, [%2]\n"
+                          "   cmp   %1, #0\n"
+                          "   bne   1b\n"
+                          : "=&r"(ret), "=&r"(fail)
+                          : "r"(a), "r"(value)
+                          : "memory", "cc");
+    vrm_atomic_barrier();
+
+    return ret;
+}
+
+extern bool
+vrm_atomic_cmpxchg(volatile uint32_t *a, uint32_t *expected, uint32_t desired)
+{
+    uint32_t old = 0, fail = 0;
+
+    /* Gives up the reservation when the value differs */
+    vrm_atomic_barrier();
+    __asm__ __volatile__ ("1: ldrex %0, [%2]\n"
+                          "   cmp   %0, %3\n"
+                          "   bne   2f\n"
+                          "   strex %1, %4, [%2]\n"
+                          "   cmp   %1, #0\n"
+                          "   bne   1b\n"
+                          "   b     3f\n"
+                          "2: clrex\n"
+                          "3:\n"
+                          : "=&r"(old), "=&r"(fail)
+                          : "r"(a), "r"(*expected), "r"(desired)
+                          : "memory", "cc");
+    vrm_atomic_barrier();
+
+    bool ret = (old == *expected);
+    *expected = old;
+
+    return ret;
+}
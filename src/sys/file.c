@@ -16,10 +16,16 @@
 
 #define VERMILLION_INTERNALS
 #include <vermillion/sys/file.h>
+#include <vermillion/sys/sync.h>
 #include <vermillion/util/mem.h>
 #include <vermillion/util/str.h>
+#include <vermillion/util/slab.h>
 #include <vermillion/util/types.h>
 
+/* Shared buffers and drivers, waited on for the length of the I/O */
+
+static vrm_mutex file_lock = VRM_MUTEX_INIT;
+
 /* Path utils */
 
 static char vrm_path_buffer[VRM_FILE_PATH_S] = {0};
@@ -30,8 +36,8 @@ vrm_file_validate(const char *path)
     return (vrm_str_length(path) < VRM_FILE_PATH_S);
 }
 
-extern void
-vrm_file_sanitize(char *path)
+static void
+file_sanitize(char *path)
 {
     vrm_path_buffer[0] = '/';
     if (path[0] == '/')
@@ -96,6 +102,14 @@ vrm_file_basename(char *path)
 static dev_fs *dev_l = NULL;
 static uint8_t dev_c = 0;
 
+static vrm_slab *file_cache = NULL;
+
+extern void
+file_init(void)
+{
+    file_cache = vrm_slab_create("vrm_file", sizeof(struct vrm_file), 0);
+}
+
 extern void
 file_setup(dev_fs *list, uint8_t count)
 {
@@ -113,10 +127,13 @@ file_setup(dev_fs *list, uint8_t count)
 
 static char vrm_file_buffer[VRM_FILE_PATH_S] = {0};
 
-extern struct vrm_file *
-vrm_file_open(uint8_t id, const char *path)
+static bool file_flush (struct vrm_file *f);
+static bool file_resize(struct vrm_file *f, uint32_t size);
+
+static struct vrm_file *
+file_open(uint8_t id, const char *path)
 {
-    struct vrm_file *f = vrm_mem_new(sizeof(struct vrm_file));
+    struct vrm_file *f = vrm_slab_alloc(file_cache);
 
     bool success = false;
     if (f && vrm_file_validate(path))
@@ -125,7 +142,7 @@ vrm_file_open(uint8_t id, const char *path)
         success = true;
 
         vrm_str_copy(vrm_file_buffer, path, 0);
-        vrm_file_sanitize(vrm_file_buffer);
+        file_sanitize(vrm_file_buffer);
 
         f->location = FS_ROOT();
         f->dir      = true;
@@ -161,22 +178,22 @@ vrm_file_open(uint8_t id, const char *path)
         if (!(f->dir) && f->size)
         {
             if (!FS_CALL(read, f->location, f->buffer, 0))
-                f = vrm_mem_del(f);
+                f = vrm_slab_free(file_cache, f);
         }
     }
     else
-        f = vrm_mem_del(f);
+        f = vrm_slab_free(file_cache, f);
 
     return f;
 }
 
-extern struct vrm_file *
-vrm_file_close(struct vrm_file *f)
+static struct vrm_file *
+file_close(struct vrm_file *f)
 {
     if (f)
-        vrm_file_flush(f);
+        file_flush(f);
 
-    return vrm_mem_del(f);
+    return vrm_slab_free(file_cache, f);
 }
 
 extern bool
@@ -195,9 +212,9 @@ vrm_file_stat(struct vrm_file *f, bool *dir, uint32_t *size)
     return ret;
 }
 
-extern bool
-vrm_file_walk(struct vrm_file *f, uint32_t *idx,
-              bool *dir, char *name, uint32_t *size)
+static bool
+file_walk(struct vrm_file *f, uint32_t *idx,
+          bool *dir, char *name, uint32_t *size)
 {
     bool ret = false;
 
@@ -234,7 +251,7 @@ vrm_file_tell(struct vrm_file *f, uint32_t *pos)
 }
 
 static uint32_t
-vrm_file_rw(struct vrm_file *f, void *buffer, uint32_t bytes, bool w)
+file_rw(struct vrm_file *f, void *buffer, uint32_t bytes, bool w)
 {
     uint32_t ret = 0;
 
@@ -244,7 +261,7 @@ vrm_file_rw(struct vrm_file *f, void *buffer, uint32_t bytes, bool w)
         {
             uint32_t needed = f->pos + bytes;
             if (needed > f->size)
-                if (!vrm_file_resize(f, needed))
+                if (!file_resize(f, needed))
                     bytes = 0;
         }
 
@@ -291,20 +308,8 @@ vrm_file_rw(struct vrm_file *f, void *buffer, uint32_t bytes, bool w)
     return ret;
 }
 
-extern uint32_t
-vrm_file_read(struct vrm_file *f, void *buffer, uint32_t bytes)
-{
-    return vrm_file_rw(f, buffer, bytes, false);
-}
-
-extern uint32_t
-vrm_file_write(struct vrm_file *f, const void *buffer, uint32_t bytes)
-{
-    return vrm_file_rw(f, (void *)buffer, bytes, true);
-}
-
-extern bool
-vrm_file_flush(struct vrm_file *f)
+static bool
+file_flush(struct vrm_file *f)
 {
     if (f && f->flush)
         f->flush = !(FS_CALL(write, f->location, f->buffer, f->block));
@@ -312,63 +317,63 @@ vrm_file_flush(struct vrm_file *f)
     return (f && !(f->flush));
 }
 
-extern bool
-vrm_file_create(uint8_t id, const char *path, bool dir)
+static bool
+file_create(uint8_t id, const char *path, bool dir)
 {
     bool ret = vrm_file_validate(path);
 
     if (ret)
     {
-        struct vrm_file *check = vrm_file_open(id, path);
+        struct vrm_file *check = file_open(id, path);
 
         if (!check)
         {
             vrm_str_copy(vrm_file_buffer, path, 0);
-            vrm_file_sanitize(vrm_file_buffer);
+            file_sanitize(vrm_file_buffer);
             vrm_file_dirname(vrm_file_buffer);
 
-            struct vrm_file *f = vrm_file_open(id, vrm_file_buffer);
+            struct vrm_file *f = file_open(id, vrm_file_buffer);
 
             if (f && f->dir)
             {
                 vrm_str_copy(vrm_file_buffer, path, 0);
-                vrm_file_sanitize(vrm_file_buffer);
+                file_sanitize(vrm_file_buffer);
                 vrm_file_basename(vrm_file_buffer);
                 ret = FS_CALL(create, f->location, vrm_file_buffer, dir, 0, 0);
             }
             else
                 ret = false;
 
-            vrm_file_close(f);
+            file_close(f);
         }
         else
             ret = false;
 
-        vrm_file_close(check);
+        file_close(check);
     }
 
     return ret;
 }
 
-extern bool
-vrm_file_remove(uint8_t id, const char *path)
+static bool
+file_remove(uint8_t id, const char *path)
 {
     bool ret = false;
 
-    struct vrm_file *f = vrm_file_open(id, path);
+    struct vrm_file *f = file_open(id, path);
     if (f)
         ret = FS_CALL(remove, f->parent, f->idx, true);
 
     if (ret)
-        vrm_mem_del(f);
+        vrm_slab_free(file_cache, f);
     else
-        vrm_file_close(f);
+        file_close(f);
 
     return ret;
 }
 
-extern bool
-vrm_file_resize(struct vrm_file *f, uint32_t size)
+static bool
+file_resize(struct vrm_file *f, uint32_t size)
 {
     bool ret = (f && !(f->dir));
 
@@ -380,27 +385,27 @@ vrm_file_resize(struct vrm_file *f, uint32_t size)
     return ret;
 }
 
-extern bool
-vrm_file_move(struct vrm_file *f, const char *path)
+static bool
+file_move(struct vrm_file *f, const char *path)
 {
     bool ret = vrm_file_validate(path);
 
     if (ret)
     {
-        struct vrm_file *check = vrm_file_open(f->dev, path);
+        struct vrm_file *check = file_open(f->dev, path);
 
         if (!check)
         {
             vrm_str_copy(vrm_file_buffer, path, 0);
-            vrm_file_sanitize(vrm_file_buffer);
+            file_sanitize(vrm_file_buffer);
             vrm_file_dirname(vrm_file_buffer);
 
-            struct vrm_file *p = vrm_file_open(f->dev, vrm_file_buffer);
+            struct vrm_file *p = file_open(f->dev, vrm_file_buffer);
 
             if (p && p->dir)
             {
                 vrm_str_copy(vrm_file_buffer, path, 0);
-                vrm_file_sanitize(vrm_file_buffer);
+                file_sanitize(vrm_file_buffer);
                 vrm_file_basename(vrm_file_buffer);
                 ret = FS_CALL(remove, f->parent, f->idx, false) &&
                       FS_CALL(create, f->parent,
@@ -409,13 +414,124 @@ vrm_file_move(struct vrm_file *f, const char *path)
             else
                 ret = false;
 
-            vrm_file_close(p);
+            file_close(p);
         }
         else
             ret = false;
 
-        vrm_file_close(check);
+        file_close(check);
     }
 
     return ret;
 }
+
+/* Locked entry points */
+
+extern void
+vrm_file_sanitize(char *path)
+{
+    vrm_mutex_lock(&file_lock);
+    file_sanitize(path);
+    vrm_mutex_unlock(&file_lock);
+}
+
+extern struct vrm_file *
+vrm_file_open(uint8_t id, const char *path)
+{
+    vrm_mutex_lock(&file_lock);
+    struct vrm_file *ret = file_open(id, path);
+    vrm_mutex_unlock(&file_lock);
+
+    return ret;
+}
+
+extern struct vrm_file *
+vrm_file_close(struct vrm_file *f)
+{
+    vrm_mutex_lock(&file_lock);
+    struct vrm_file *ret = file_close(f);
+    vrm_mutex_unlock(&file_lock);
+
+    return ret;
+}
+
+extern bool
+vrm_file_walk(struct vrm_file *f, uint32_t *idx,
+              bool *dir, char *name, uint32_t *size)
+{
+    vrm_mutex_lock(&file_lock);
+    bool ret = file_walk(f, idx, dir, name, size);
+    vrm_mutex_unlock(&file_lock);
+
+    return ret;
+}
+
+extern uint32_t
+vrm_file_read(struct vrm_file *f, void *buffer, uint32_t bytes)
+{
+    vrm_mutex_lock(&file_lock);
+    uint32_t ret = file_rw(f, buffer, bytes, false);
+    vrm_mutex_unlock(&file_lock);
+
+    return ret;
+}
+
+extern uint32_t
+vrm_file_write(struct vrm_file *f, const void *buffer, uint32_t bytes)
+{
+    vrm_mutex_lock(&file_lock);
+    uint32_t ret = file_rw(f, (void *)buffer, bytes, true);
+    vrm_mutex_unlock(&file_lock);
+
+    return ret;
+}
+
+extern bool
+vrm_file_flush(struct vrm_file *f)
+{
+    vrm_mutex_lock(&file_lock);
+    bool ret = file_flush(f);
+    vrm_mutex_unlock(&file_lock);
+
+    return ret;
+}
+
+extern bool
+vrm_file_create(uint8_t id, const char *path, bool dir)
+{
+    vrm_mutex_lock(&file_lock);
+    bool ret = file_create(id, path, dir);
+    vrm_mutex_unlock(&file_lock);
+
+    return ret;
+}
+
+extern bool
+vrm_file_remove(uint8_t id, const char *path)
+{
+    vrm_mutex_lock(&file_lock);
+    bool ret = file_remove(id, path);
+    vrm_mutex_unlock(&file_lock);
+
+    return ret;
+}
+
+extern bool
+vrm_file_resize(struct vrm_file *f, uint32_t size)
+{
+    vrm_mutex_lock(&file_lock);
+    bool ret = file_resize(f, size);
+    vrm_mutex_unlock(&file_lock);
+
+    return ret;
+}
+
+extern bool
+vrm_file_move(struct vrm_file *f, const char *path)
+{
+    vrm_mutex_lock(&file_lock);
+    bool ret = file_move(f, path);
+    vrm_mutex_unlock(&file_lock);
+
+    return ret;
+}
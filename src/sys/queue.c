@@ -0,0 +1,188 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <vermillion/sys/spin.h>
+#include <vermillion/sys/sync.h>
+#include <vermillion/sys/task.h>
+#include <vermillion/sys/queue.h>
+#include <vermillion/util/mem.h>
+#include <vermillion/util/types.h>
+
+/* Ring of slots, with a semaphore counting each side */
+
+struct vrm_queue
+{
+    vrm_spin lock;
+    vrm_sem items, spaces;
+
+    size_t size, count;
+    size_t head, tail;
+    size_t depth, peak;
+    uint32_t sends, recvs, failed;
+
+    uint8_t *slots;
+};
+
+static void
+queue_put(struct vrm_queue *q, const void *item)
+{
+    uint32_t flags = vrm_spin_irqsave(&(q->lock));
+
+    uint8_t *slot = &(q->slots[q->tail * q->size]);
+    if (q->size == sizeof(void *))
+        *(void **)slot = *(void * const *)item;
+    else
+        vrm_mem_copy(slot, item, q->size);
+
+    q->tail = (q->tail + 1) % q->count;
+    q->depth++;
+    if (q->depth > q->peak)
+        q->peak = q->depth;
+    q->sends++;
+
+    vrm_spin_irqrestore(&(q->lock), flags);
+}
+
+static void
+queue_get(struct vrm_queue *q, void *item)
+{
+    uint32_t flags = vrm_spin_irqsave(&(q->lock));
+
+    uint8_t *slot = &(q->slots[q->head * q->size]);
+    if (q->size == sizeof(void *))
+        *(void **)item = *(void **)slot;
+    else
+        vrm_mem_copy(item, slot, q->size);
+
+    q->head = (q->head + 1) % q->count;
+    q->depth--;
+    q->recvs++;
+
+    vrm_spin_irqrestore(&(q->lock), flags);
+}
+
+static bool
+queue_take(struct vrm_queue *q, vrm_sem *s, uint32_t us)
+{
+    bool ret = false;
+
+    if (us == 0)
+        ret = vrm_sem_trywait(s);
+    else if (us == VRM_QUEUE_FOREVER)
+        ret = vrm_sem_wait_until(s, 0);
+    else
+        ret = vrm_sem_wait_until(s, vrm_task_clock() + us);
+
+    if (!ret)
+    {
+        uint32_t flags = vrm_spin_irqsave(&(q->lock));
+        q->failed++;
+        vrm_spin_irqrestore(&(q->lock), flags);
+    }
+
+    return ret;
+}
+
+extern struct vrm_queue *
+vrm_queue_create(size_t count, size_t size)
+{
+    struct vrm_queue *ret = NULL;
+
+    /* Slots right after the header, which keeps them word aligned */
+    if (count && size)
+        ret = vrm_mem_new(sizeof(struct vrm_queue) + (count * size));
+
+    if (ret)
+    {
+        vrm_mem_fill(ret, 0, sizeof(struct vrm_queue));
+
+        ret->size  = size;
+        ret->count = count;
+        ret->slots = (uint8_t *)&(ret[1]);
+
+        ret->items  = (vrm_sem)VRM_SEM_INIT(0);
+        ret->spaces = (vrm_sem)VRM_SEM_INIT(count);
+    }
+
+    return ret;
+}
+
+extern struct vrm_queue *
+vrm_queue_delete(struct vrm_queue *q)
+{
+    /* With no task waiting on it anymore */
+    return vrm_mem_del(q);
+}
+
+extern bool
+vrm_queue_send(struct vrm_queue *q, const void *item, uint32_t us)
+{
+    bool ret = false;
+
+    if (q && item)
+        ret = queue_take(q, &(q->spaces), us);
+
+    if (ret)
+    {
+        queue_put(q, item);
+        vrm_sem_post(&(q->items));
+    }
+
+    return ret;
+}
+
+extern bool
+vrm_queue_recv(struct vrm_queue *q, void *item, uint32_t us)
+{
+    bool ret = false;
+
+    if (q && item)
+        ret = queue_take(q, &(q->items), us);
+
+    if (ret)
+    {
+        queue_get(q, item);
+        vrm_sem_post(&(q->spaces));
+    }
+
+    return ret;
+}
+
+extern bool
+vrm_queue_send_isr(struct vrm_queue *q, const void *item)
+{
+    /* Never waits, and a receiver it wakes preempts on the way out */
+    return vrm_queue_send(q, item, 0);
+}
+
+extern void
+vrm_queue_stats(struct vrm_queue *q, vrm_queue_info *info)
+{
+    if (q && info)
+    {
+        uint32_t flags = vrm_spin_irqsave(&(q->lock));
+
+        info->size   = q->size;
+        info->count  = q->count;
+        info->depth  = q->depth;
+        info->peak   = q->peak;
+        info->sends  = q->sends;
+        info->recvs  = q->recvs;
+        info->failed = q->failed;
+
+        vrm_spin_irqrestore(&(q->lock), flags);
+    }
+}
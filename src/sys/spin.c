@@ -0,0 +1,79 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <vermillion/sys/spin.h>
+#include <vermillion/sys/atomic.h>
+#include <vermillion/util/types.h>
+
+#define SPIN_NEXT(t)  ((t) >> 16)
+#define SPIN_OWNER(t) ((t) & 0xFFFF)
+
+#define CPSR_I (1 << 7)
+
+extern void
+vrm_spin_lock(vrm_spin *s)
+{
+    uint32_t t = vrm_atomic_add(&(s->ticket), 1 << 16) - (1 << 16);
+
+    /* Woken up by the sev on every unlock */
+    while (SPIN_OWNER(vrm_atomic_load(&(s->ticket))) != SPIN_NEXT(t))
+        __asm__ __volatile__ ("wfe");
+}
+
+extern bool
+vrm_spin_trylock(vrm_spin *s)
+{
+    bool ret = false;
+
+    uint32_t t = vrm_atomic_load(&(s->ticket));
+    if (SPIN_NEXT(t) == SPIN_OWNER(t))
+        ret = vrm_atomic_cmpxchg(&(s->ticket), &t, t + (1 << 16));
+
+    return ret;
+}
+
+extern void
+vrm_spin_unlock(vrm_spin *s)
+{
+    /* Only the owner half changes, without carrying into the next */
+    uint32_t t = vrm_atomic_load(&(s->ticket));
+    while (!vrm_atomic_cmpxchg(&(s->ticket), &t,
+                               (t & 0xFFFF0000) | SPIN_OWNER(t + 1)));
+
+    __asm__ __volatile__ ("dsb ish");
+    __asm__ __volatile__ ("sev");
+}
+
+extern uint32_t
+vrm_spin_irqsave(vrm_spin *s)
+{
+    uint32_t ret = 0;
+    __asm__ __volatile__ ("mrs %0, cpsr" : "=r"(ret));
+    __asm__ __volatile__ ("cpsid i" ::: "memory");
+
+    vrm_spin_lock(s);
+
+    return ret & CPSR_I;
+}
+
+extern void
+vrm_spin_irqrestore(vrm_spin *s, uint32_t flags)
+{
+    vrm_spin_unlock(s);
+
+    if (!(flags & CPSR_I))
+        __asm__ __volatile__ ("cpsie i" ::: "memory");
+}
@@ -0,0 +1,328 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define VERMILLION_INTERNALS
+#include <vermillion/sys/spin.h>
+#include <vermillion/sys/sync.h>
+#include <vermillion/sys/task.h>
+#include <vermillion/util/types.h>
+
+/* Wait queues */
+
+/* Lives on the stack of the waiting task */
+struct vrm_waiter
+{
+    vrm_task *task;
+    uint8_t priority;
+    bool woken;
+
+    struct vrm_waiter *next;
+};
+
+static void
+sync_enqueue(struct vrm_waiter **head, struct vrm_waiter *w)
+{
+    /* Behind the ones of the same priority, so they're served in order */
+    while (*head && (*head)->priority >= w->priority)
+        head = &((*head)->next);
+
+    w->next = *head;
+    *head   = w;
+}
+
+static vrm_task *
+sync_dequeue(struct vrm_waiter **head)
+{
+    vrm_task *ret = NULL;
+
+    struct vrm_waiter *w = *head;
+    if (w)
+    {
+        *head = w->next;
+
+        /* Seen once the object is released, the frame may go after that */
+        ret = w->task;
+        w->woken = true;
+        if (ret)
+            vrm_task_unblock(ret);
+    }
+
+    return ret;
+}
+
+static void
+sync_unlink(struct vrm_waiter **head, struct vrm_waiter *w)
+{
+    while (*head && *head != w)
+        head = &((*head)->next);
+
+    if (*head)
+        *head = w->next;
+}
+
+static bool
+sync_park(vrm_spin *lock, uint32_t *flags,
+          struct vrm_waiter **head, struct vrm_waiter *w, uint64_t deadline)
+{
+    /* Blocked before the object is released so no wakeup is missed,
+     * the reschedule it sends is taken once IRQs are unmasked */
+    bool expired = false;
+    while (!(w->woken) && !expired)
+    {
+        if (w->task && !deadline)
+            vrm_task_block(NULL);
+        else if (w->task)
+            task_block_until(deadline);
+
+        vrm_spin_irqrestore(lock, *flags);
+        *flags = vrm_spin_irqsave(lock);
+
+        expired = deadline && vrm_task_clock() >= deadline;
+    }
+
+    /* Timed out, unless woken on the way */
+    if (!(w->woken))
+        sync_unlink(head, w);
+
+    return w->woken;
+}
+
+static bool
+sync_wait(vrm_spin *lock, uint32_t *flags,
+          struct vrm_waiter **head, uint64_t deadline)
+{
+    bool ret = false;
+
+    /* Without a task to park, as before the scheduler, it only spins */
+    struct vrm_waiter w = {.task = vrm_task_self()};
+    if (w.task && task_park(w.task, true))
+    {
+        w.priority = task_level(w.task);
+        sync_enqueue(head, &w);
+        ret = sync_park(lock, flags, head, &w, deadline);
+        task_park(w.task, false);
+    }
+    else
+    {
+        vrm_spin_irqrestore(lock, *flags);
+        *flags = vrm_spin_irqsave(lock);
+    }
+
+    return ret;
+}
+
+/* Mutexes */
+
+extern void
+vrm_mutex_lock(vrm_mutex *m)
+{
+    vrm_task *self = vrm_task_self();
+    uint32_t flags = vrm_spin_irqsave(&(m->lock));
+
+    if (m->locked)
+    {
+        m->contended++;
+
+        /* Handed over on unlock, or retried when it can't park */
+        bool owned = false;
+        while (!owned)
+        {
+            if (task_level(m->owner) < task_level(self))
+                task_inherit(m->owner, task_level(self));
+
+            owned = sync_wait(&(m->lock), &flags, &(m->waiters), 0);
+            if (!owned && !(m->locked))
+            {
+                m->locked = true;
+                m->owner  = self;
+                owned     = true;
+            }
+        }
+    }
+    else
+    {
+        m->locked = true;
+        m->owner  = self;
+    }
+
+    m->locks++;
+    task_hold(self, true);
+
+    vrm_spin_irqrestore(&(m->lock), flags);
+}
+
+extern bool
+vrm_mutex_trylock(vrm_mutex *m)
+{
+    bool ret = false;
+
+    vrm_task *self = vrm_task_self();
+    uint32_t flags = vrm_spin_irqsave(&(m->lock));
+
+    if (!(m->locked))
+    {
+        m->locked = true;
+        m->owner  = self;
+        m->locks++;
+        task_hold(self, true);
+        ret = true;
+    }
+    else
+        m->contended++;
+
+    vrm_spin_irqrestore(&(m->lock), flags);
+
+    return ret;
+}
+
+extern void
+vrm_mutex_unlock(vrm_mutex *m)
+{
+    uint32_t flags = vrm_spin_irqsave(&(m->lock));
+
+    task_hold(m->owner, false);
+
+    /* Straight to the first waiter, which inherits from the rest */
+    m->owner  = sync_dequeue(&(m->waiters));
+    m->locked = (m->owner != NULL);
+    if (m->waiters && task_level(m->owner) < m->waiters->priority)
+        task_inherit(m->owner, m->waiters->priority);
+
+    vrm_spin_irqrestore(&(m->lock), flags);
+}
+
+/* Semaphores */
+
+extern bool
+vrm_sem_wait_until(vrm_sem *s, uint64_t deadline)
+{
+    bool ret = false;
+
+    uint32_t flags = vrm_spin_irqsave(&(s->lock));
+
+    s->waits++;
+    if (s->count)
+    {
+        s->count--;
+        ret = true;
+    }
+    else
+    {
+        s->contended++;
+
+        /* Posts hand their unit to the first waiter */
+        bool expired = false;
+        while (!ret && !expired)
+        {
+            ret = sync_wait(&(s->lock), &flags, &(s->waiters), deadline);
+            if (!ret && s->count)
+            {
+                s->count--;
+                ret = true;
+            }
+
+            expired = deadline && vrm_task_clock() >= deadline;
+        }
+    }
+
+    vrm_spin_irqrestore(&(s->lock), flags);
+
+    return ret;
+}
+
+extern void
+vrm_sem_wait(vrm_sem *s)
+{
+    vrm_sem_wait_until(s, 0);
+}
+
+extern bool
+vrm_sem_trywait(vrm_sem *s)
+{
+    bool ret = false;
+
+    uint32_t flags = vrm_spin_irqsave(&(s->lock));
+
+    s->waits++;
+    if (s->count)
+    {
+        s->count--;
+        ret = true;
+    }
+    else
+        s->contended++;
+
+    vrm_spin_irqrestore(&(s->lock), flags);
+
+    return ret;
+}
+
+extern void
+vrm_sem_post(vrm_sem *s)
+{
+    uint32_t flags = vrm_spin_irqsave(&(s->lock));
+
+    if (!sync_dequeue(&(s->waiters)))
+        s->count++;
+
+    vrm_spin_irqrestore(&(s->lock), flags);
+}
+
+/* Condition variables */
+
+extern void
+vrm_cond_wait(vrm_cond *c, vrm_mutex *m)
+{
+    uint32_t flags = vrm_spin_irqsave(&(c->lock));
+    c->waits++;
+
+    /* Queued before the mutex is released, so no signal is missed,
+     * unless the task is being removed and has nothing to wait for */
+    struct vrm_waiter w = {.task = vrm_task_self()};
+    bool parked = task_park(w.task, true);
+    if (parked)
+    {
+        w.priority = task_level(w.task);
+        sync_enqueue(&(c->waiters), &w);
+    }
+
+    vrm_mutex_unlock(m);
+    if (parked)
+    {
+        sync_park(&(c->lock), &flags, &(c->waiters), &w, 0);
+        task_park(w.task, false);
+    }
+
+    vrm_spin_irqrestore(&(c->lock), flags);
+    vrm_mutex_lock(m);
+}
+
+extern void
+vrm_cond_signal(vrm_cond *c)
+{
+    uint32_t flags = vrm_spin_irqsave(&(c->lock));
+    sync_dequeue(&(c->waiters));
+    vrm_spin_irqrestore(&(c->lock), flags);
+}
+
+extern void
+vrm_cond_broadcast(vrm_cond *c)
+{
+    uint32_t flags = vrm_spin_irqsave(&(c->lock));
+    while (c->waiters)
+        sync_dequeue(&(c->waiters));
+    vrm_spin_irqrestore(&(c->lock), flags);
+}
@@ -15,217 +15,666 @@
 */
 
 #include <arch/gic.h>
+#include <arch/smp.h>
+#ifdef CONFIG_ARM_COUNTER
+#include <arch/counter.h>
+#endif
 
+#define VERMILLION_INTERNALS
+#include <vermillion/sys/spin.h>
 #include <vermillion/sys/task.h>
+#include <vermillion/sys/atomic.h>
 #include <vermillion/util/mem.h>
+#include <vermillion/util/slab.h>
+#include <vermillion/util/debug.h>
 #include <vermillion/hal/timer.h>
 
 /* Register state control */
 
+/* Same layout as the IRQ frame: r0-r12, sp, lr, return address, cpsr */
 struct state
 {
     uint32_t gpr[17];
 } __attribute__((packed, aligned(4)));
 
+#define STATE_SP   13
+#define STATE_LR   14
+#define STATE_PC   15
+#define STATE_CPSR 16
+
+/* System mode, with the Thumb bit for odd entry addresses */
+#define CPSR_SYS   0x1F
+#define CPSR_THUMB 0x20
+
 static void
-state_save_irq(struct state *st)
+state_save(struct state *st, const uint32_t *frame)
 {
-    /* Saving original registers from gic_irq_regs */
     for (uint8_t i = 0; i < 17; i++)
-        st->gpr[i] = gic_irq_regs[i];
+        st->gpr[i] = frame[i];
 }
 
-__attribute__((naked, noreturn))
 static void
-state_load_irq(struct state *st)
-{
-    (void)st;
-
-    /* Call parameters: st -> r0 */
-
-    /* Loading registers */
-    __asm__ __volatile__ ("add r0, r0, #16");
-    __asm__ __volatile__ ("ldmia r0!, {r4-r12}");
-    /* Including the actual sp and lr from the task */
-    __asm__ __volatile__ ("ldmia r0,  {sp, lr}^");
-    /* Setting lr to program counter */
-    __asm__ __volatile__ ("add r0, r0, #8");
-    __asm__ __volatile__ ("ldr lr, [r0]");
-    /* Loading cpsr into spsr */
-    __asm__ __volatile__ ("add r0, r0, #4");
-    __asm__ __volatile__ ("ldr r1, [r0]");
-    __asm__ __volatile__ ("msr spsr, r1");
-    /* Loading original r0-r3 */
-    __asm__ __volatile__ ("sub r0, r0, #60");
-    __asm__ __volatile__ ("ldmia r0, {r1-r3}");
-    __asm__ __volatile__ ("sub r0, r0, #4");
-    __asm__ __volatile__ ("ldr r0, [r0]");
-    /* Flushes all the changes */
-    __asm__ __volatile__ ("dsb sy");
-    __asm__ __volatile__ ("isb");
-    /* Jumping to address (using exception return) */
-    __asm__ __volatile__ ("subs pc, lr, #4");
-
-    /* Supressing compiler warning */
-    while (true);
-}
-
-/* Context switch control */
+state_load(const struct state *st, uint32_t *frame)
+{
+    /* Taken by the IRQ epilogue on its exception return */
+    for (uint8_t i = 0; i < 17; i++)
+        frame[i] = st->gpr[i];
+}
+
+/* Context control */
+
+/* Stacks are allocated apart, 8-byte aligned as the AAPCS wants */
+#define STACK_ALIGN 8
+#define STACK_MIN   0x400
+
+#ifdef CONFIG_TASK_STACK_PAINT
+/* Painted at creation, so the words never written can be told apart */
+#define STACK_PAINT 0xA5A5A5A5
+
+/* Closest a switched out task may get to its stack end */
+#ifdef CONFIG_TASK_STACK_GUARD
+#define STACK_GUARD CONFIG_TASK_STACK_GUARD
+#else
+#define STACK_GUARD 0x100
+#endif
+#endif
 
 struct context
 {
     void (*f)(void *), *arg;
-    uint8_t stack[CONFIG_STACK_SIZE];
+    uint8_t *stack;
+    size_t size;
+};
+
+static void
+task_exit(void)
+{
+    /* Tasks returning from their function land here */
+    vrm_task_remove(NULL);
+    while (true)
+        vrm_task_yield();
+}
+
+static void
+context_init(struct state *st, struct context *ctx)
+{
+    vrm_mem_fill(st, 0, sizeof(struct state));
+
+    uint32_t entry = (uint32_t)ctx->f;
+    st->gpr[0]          = (uint32_t)ctx->arg;
+    st->gpr[STATE_SP]   = (uint32_t)&(ctx->stack[ctx->size]);
+    st->gpr[STATE_LR]   = (uint32_t)task_exit;
+    st->gpr[STATE_PC]   = (entry & ~1) + 4;
+    st->gpr[STATE_CPSR] = CPSR_SYS | ((entry & 1) ? CPSR_THUMB : 0);
+}
+
+/* Task implementation */
+
+struct tlist
+{
+    struct vrm_task *head, *tail;
+};
+
+/* What picks and switches read comes first, within one cache line */
+#define TASK_ALIGN 64
+
+struct vrm_task
+{
+    /* List it sits on, none while running */
+    struct tlist *list;
+    struct vrm_task *prev, *next;
+
+    /* Scheduled at the higher of its own and the one lent by waiters,
+     * lent until it releases the last mutex it holds */
+    uint8_t priority, base, inherit, held;
+    enum vrm_task_st status;
+    bool suspended;
+
+    /* Waiting on a sync object, whose queue links into its stack */
+    bool parked;
+
+    /* Queue holding the task, cores allowed, and whether it's on one */
+    uint8_t core;
+    uint32_t affinity;
+    bool running;
+
+    /* Sleep deadline while queued, and whether a tick is waking it,
+     * linked apart from the sleeps as it may sleep again meanwhile */
+    bool waking;
+    uint64_t wake;
+    struct vrm_task *sleep_next, *wake_next;
+
+    struct state state;
+    struct context ctx;
 };
 
-__attribute__((naked, noreturn))
+/* Per-core run queues */
+
+struct runq
+{
+    vrm_spin lock;
+
+    /* Ready tasks only, with a bit set for each non-empty priority */
+    struct tlist ready[32];
+    uint32_t bitmap;
+    uint32_t count;
+
+    /* Tasks waiting for an unblock or a resume */
+    struct tlist blocked, suspended;
+
+    /* Running task, or the interrupted scheduler loop when NULL */
+    struct vrm_task *current;
+    struct state idle;
+};
+
+static struct runq runqs[SMP_CORES] = {0};
+
+/* Cores taking part in scheduling */
+static volatile uint32_t active = 0;
+
+#define CORES_ALL ((1U << SMP_CORES) - 1)
+
+static vrm_slab *task_cache = NULL;
+
+static void
+list_push(struct tlist *l, struct vrm_task *t)
+{
+    t->prev = l->tail;
+    if (t->prev)
+        t->prev->next = t;
+    t->next = NULL;
+
+    if (!(l->head))
+        l->head = t;
+    l->tail = t;
+
+    t->list = l;
+}
+
 static void
-context_run_irq(struct context *ctx)
+list_pull(struct tlist *l, struct vrm_task *t)
 {
-    /* Variable to the end/base of the stack */
-    static uint32_t stack = 0;
-    stack = ((uint32_t)ctx->stack) + CONFIG_STACK_SIZE;
+    if (l->head == t)
+        l->head = t->next;
+    if (l->tail == t)
+        l->tail = t->prev;
+
+    if (t->prev)
+        t->prev->next = t->next;
+    if (t->next)
+        t->next->prev = t->prev;
+
+    t->prev = NULL;
+    t->next = NULL;
+    t->list = NULL;
+}
 
-    /* Setting stack to allocated address */
-    __asm__ __volatile__ ("ldmia %0, {fp}^" :: "r"(&stack));
-    __asm__ __volatile__ ("ldmia %0, {sp}^" :: "r"(&stack));
+static void
+task_insert(struct runq *rq, struct vrm_task *t)
+{
+    t->core = rq - runqs;
 
-    /* Setting Saved CPSR to System mode, either ARM or Thumb state */
-    if ((uintptr_t)ctx->f & 1)
+    /* Running tasks are filed again when switched out */
+    if (!(t->running))
     {
-        __asm__ __volatile__ ("mov r0, #0x3f");
-        __asm__ __volatile__ ("msr spsr_c, r0");
-        ctx->f = (void *)((uintptr_t)ctx->f & ~1);
+        if (t->suspended)
+            list_push(&(rq->suspended), t);
+        else if (t->status == VRM_TASK_BLOCKED)
+            list_push(&(rq->blocked), t);
+        else
+        {
+            list_push(&(rq->ready[t->priority]), t);
+            rq->bitmap |= 1U << t->priority;
+            rq->count++;
+        }
     }
-    else
+}
+
+static void
+task_remove(struct runq *rq, struct vrm_task *t)
+{
+    struct tlist *l = t->list;
+
+    if (l == &(rq->ready[t->priority]))
     {
-        __asm__ __volatile__ ("mov r0, #0x1f");
-        __asm__ __volatile__ ("msr spsr_c, r0");
+        list_pull(l, t);
+        if (!(l->head))
+            rq->bitmap &= ~(1U << t->priority);
+        rq->count--;
     }
+    else if (l)
+        list_pull(l, t);
+}
+
+static struct runq *
+task_lock(struct vrm_task *t, uint32_t *flags)
+{
+    struct runq *ret = NULL;
 
-    /* Flushes all the changes */
-    __asm__ __volatile__ ("dsb sy");
-    __asm__ __volatile__ ("isb");
+    /* The task may migrate until its queue is held */
+    bool held = false;
+    while (!held)
+    {
+        ret = &(runqs[t->core]);
+        *flags = vrm_spin_irqsave(&(ret->lock));
 
-    /* Jumping to function (as an exception return) */
-    __asm__ __volatile__ ("mov  r0, %0\n"
-                          "movs pc, %1\n"
-                          :
-                          : "r"(ctx->arg), "r"(ctx->f)
-                          : "r0");
+        held = (ret == &(runqs[t->core]));
+        if (!held)
+            vrm_spin_irqrestore(&(ret->lock), *flags);
+    }
 
-    /* Supressing compiler warning */
-    while (true);
+    return ret;
 }
 
-/* Task implementation */
+/* Moves hold both queues, always the lower core first */
 
-struct vrm_task
+static uint32_t
+task_lock_both(struct runq *a, struct runq *b)
 {
-    uint8_t priority;
-    enum vrm_task_st status;
-    bool suspended;
+    struct runq *first  = (a < b) ? a : b;
+    struct runq *second = (a < b) ? b : a;
 
-    struct state caller, callee;
-    struct context ctx;
+    uint32_t ret = vrm_spin_irqsave(&(first->lock));
+    if (second != first)
+        vrm_spin_lock(&(second->lock));
 
-    struct vrm_task *prev, *next;
-} task;
+    return ret;
+}
+
+static void
+task_unlock_both(struct runq *a, struct runq *b, uint32_t flags)
+{
+    struct runq *first  = (a < b) ? a : b;
+    struct runq *second = (a < b) ? b : a;
+
+    if (second != first)
+        vrm_spin_unlock(&(second->lock));
+    vrm_spin_irqrestore(&(first->lock), flags);
+}
+
+static struct vrm_task *
+task_self(void)
+{
+    /* Masked, so the core can't change under the lookup */
+    uint32_t cpsr = 0;
+    __asm__ __volatile__ ("mrs %0, cpsr" : "=r"(cpsr));
+    __asm__ __volatile__ ("cpsid i" ::: "memory");
+
+    struct vrm_task *ret = runqs[smp_core()].current;
+
+    if (!(cpsr & 0x80))
+        __asm__ __volatile__ ("cpsie i" ::: "memory");
+
+    return ret;
+}
+
+/* Time slicing and sleeps */
+
+/* Within what the timers take, longer waits are rearmed */
+#define TICK_MAX 10000000
+
+static struct
+{
+    vrm_spin lock;
+
+    uint8_t timer;
+    uint32_t us;
+    bool tickless;
+
+    /* Cores sharing their priority with a ready task */
+    uint32_t cores;
+
+    /* Sleeping tasks, soonest deadline first */
+    struct vrm_task *sleeping;
+
+    /* Alarm armed and end of the running slice, 0 when none */
+    uint64_t alarm, slice;
+#ifndef CONFIG_ARM_COUNTER
+    /* Advanced by the alarms, without a counter to read */
+    uint64_t now;
+#endif
+} tick = {0};
 
-static struct vrm_task *heads[32] = {NULL};
-static struct vrm_task *tails[32] = {NULL};
-static struct vrm_task *current   =  NULL ;
+static void task_tick(void *arg);
+
+static uint64_t
+task_clock(void)
+{
+#ifdef CONFIG_ARM_COUNTER
+    return counter_us();
+#else
+    return tick.now;
+#endif
+}
 
 static void
-task_insert(struct vrm_task *t)
+tick_arm(void)
 {
-    if (t)
+    /* The earliest of the slice end and the first sleep deadline */
+    uint64_t next = tick.slice;
+    if (tick.sleeping && (!next || tick.sleeping->wake < next))
+        next = tick.sleeping->wake;
+
+    if (next && (!(tick.alarm) || next < tick.alarm))
     {
-        t->prev = tails[t->priority];
-        if (t->prev)
-            t->prev->next = t;
-        t->next = NULL;
+        uint64_t now = task_clock();
+        uint64_t us = (next > now) ? next - now : 1;
+        us = (us < TICK_MAX) ? us : TICK_MAX;
 
-        if (!(heads[t->priority]))
-            heads[t->priority] = t;
-        tails[t->priority] = t;
+        vrm_timer_alarm(tick.timer, us, false, task_tick, NULL);
+        tick.alarm = now + us;
     }
 }
 
 static void
-task_remove(struct vrm_task *t)
+tick_sleep(struct vrm_task *t, uint64_t deadline)
 {
-    if (t)
+    struct vrm_task **link = &(tick.sleeping);
+    while (*link && (*link)->wake <= deadline)
+        link = &((*link)->sleep_next);
+
+    t->wake       = deadline;
+    t->sleep_next = *link;
+    *link         = t;
+
+    tick_arm();
+}
+
+static void
+tick_unsleep(struct vrm_task *t)
+{
+    struct vrm_task **link = &(tick.sleeping);
+    while (*link && *link != t)
+        link = &((*link)->sleep_next);
+
+    if (*link)
+        *link = t->sleep_next;
+
+    t->wake       = 0;
+    t->sleep_next = NULL;
+}
+
+static void
+task_slice(struct runq *rq)
+{
+    /* Tickless, slices only end while some core has another task to
+     * share its time with, as higher priorities preempt anyway */
+    if (tick.tickless)
+    {
+        struct vrm_task *cur = rq->current;
+        uint32_t core = 1U << (rq - runqs);
+        bool share = cur && rq->bitmap & (1U << cur->priority);
+
+        vrm_spin_lock(&(tick.lock));
+        tick.cores = (share) ? tick.cores | core : tick.cores & ~core;
+        if (!(tick.cores))
+            tick.slice = 0;
+        else if (!(tick.slice))
+            tick.slice = task_clock() + tick.us;
+        tick_arm();
+        vrm_spin_unlock(&(tick.lock));
+    }
+}
+
+static void
+task_unsleep(struct vrm_task *t)
+{
+    /* Called with its queue held, which always nests outside the tick */
+    if (t->wake)
+    {
+        vrm_spin_lock(&(tick.lock));
+        tick_unsleep(t);
+        vrm_spin_unlock(&(tick.lock));
+    }
+}
+
+static uint32_t
+task_stale(struct runq *rq)
+{
+    uint32_t ret = 0;
+
+    /* The changes worth a reschedule are the ones moving time slices */
+    task_slice(rq);
+
+    /* What the core runs no longer is its best choice */
+    struct vrm_task *cur = rq->current;
+    uint8_t core = rq - runqs;
+    if (active & (1 << core))
     {
-        if (t->priority < 32)
+        if (!cur)
+            ret = rq->bitmap;
+        else if (cur->suspended || cur->status != VRM_TASK_READY)
+            ret = true;
+        else
+            ret = (rq->bitmap >> cur->priority) >> 1;
+    }
+
+    /* As a core mask for the reschedule SGI, which called from an
+     * interrupt stays pending until it returns */
+    return (ret) ? 1U << core : 0;
+}
+
+static uint8_t
+task_balance(uint32_t affinity)
+{
+    uint8_t ret = smp_core();
+
+    /* Least loaded active core allowed, this one when tied */
+    uint32_t cores = affinity & active;
+    if (cores && !(cores & (1 << ret)))
+        ret = __builtin_ctz(cores);
+
+    uint32_t load = runqs[ret].count + (runqs[ret].current != NULL);
+    for (uint8_t i = 0; i < SMP_CORES; i++)
+    {
+        uint32_t other = runqs[i].count + (runqs[i].current != NULL);
+        if (cores & (1 << i) && other < load)
         {
-            if (heads[t->priority] == t)
-                heads[t->priority] =  t->next;
-            if (tails[t->priority] == t)
-                tails[t->priority] =  t->prev;
+            ret  = i;
+            load = other;
         }
+    }
+
+    return ret;
+}
+
+static void
+task_place(struct vrm_task *t, uint8_t core)
+{
+    uint32_t flags = 0;
+    struct runq *rq = &(runqs[core]);
+
+    flags = vrm_spin_irqsave(&(rq->lock));
+    task_insert(rq, t);
+    uint32_t kick = task_stale(rq);
+    vrm_spin_irqrestore(&(rq->lock), flags);
 
-        if (t->prev)
-            t->prev->next = t->next;
-        if (t->next)
-            t->next->prev = t->prev;
+    gic_sgi_mask(SMP_SGI_RESCHED, kick);
+}
+
+static void
+task_migrate(struct vrm_task *t)
+{
+    struct runq *to = &(runqs[task_balance(t->affinity)]);
+
+    /* Same as task_lock, with the destination held along */
+    uint32_t flags = 0;
+    struct runq *rq = NULL;
+    bool held = false;
+    while (!held)
+    {
+        rq = &(runqs[t->core]);
+        flags = task_lock_both(rq, to);
+
+        held = (rq == &(runqs[t->core]));
+        if (!held)
+            task_unlock_both(rq, to, flags);
+    }
+
+    /* Only tasks off the cores move, the rest at their next switch */
+    uint32_t kick = 0;
+    if (!(t->running) && rq->current != t && rq != to)
+    {
+        task_remove(rq, t);
+        task_insert(to, t);
+        kick = task_stale(to);
     }
+
+    task_unlock_both(rq, to, flags);
+    gic_sgi_mask(SMP_SGI_RESCHED, kick);
+}
+
+/* For devtree usage */
+
+extern void
+task_init(void)
+{
+    /* Before any secondary core may create tasks concurrently */
+    task_cache = vrm_slab_create("vrm_task", sizeof(struct vrm_task),
+                                 TASK_ALIGN);
 }
 
 extern struct vrm_task *
-vrm_task_create(void (*f)(void *), void *arg, uint8_t priority)
+vrm_task_create_ex(void (*f)(void *), void *arg, uint8_t priority,
+                   size_t stack_size)
 {
     struct vrm_task *ret = NULL;
 
-    if (f && priority < 32)
-        ret = vrm_mem_new(sizeof(struct vrm_task));
+    stack_size = (stack_size + STACK_ALIGN - 1) & ~(STACK_ALIGN - 1);
+    if (f && priority < 32 && stack_size >= STACK_MIN)
+        ret = vrm_slab_alloc(task_cache);
 
+    uint8_t *stack = NULL;
     if (ret)
     {
-        vrm_mem_fill(ret, 0, sizeof(struct vrm_task));
+        stack = vrm_mem_new_aligned(stack_size, STACK_ALIGN);
+        if (!stack)
+            ret = vrm_slab_free(task_cache, ret);
+    }
 
-        ret->ctx.f    = f;
-        ret->ctx.arg  = arg;
-        ret->priority = priority;
+#ifdef CONFIG_TASK_STACK_PAINT
+    if (ret)
+        vrm_mem_fill(stack, STACK_PAINT & 0xFF, stack_size);
+#endif
 
-        task_insert(ret);
+    /* Registers are set up before the task can be picked, whatever its
+     * status by then, and the stack is left as it comes unless painted */
+    if (ret)
+    {
+        ret->list       = NULL;
+        ret->prev       = NULL;
+        ret->next       = NULL;
+        ret->priority   = priority;
+        ret->base       = priority;
+        ret->inherit    = 0;
+        ret->held       = 0;
+        ret->status     = VRM_TASK_NEW;
+        ret->suspended  = false;
+        ret->parked     = false;
+        ret->affinity   = CORES_ALL;
+        ret->running    = false;
+        ret->waking     = false;
+        ret->wake       = 0;
+        ret->sleep_next = NULL;
+        ret->wake_next  = NULL;
+
+        ret->ctx.f     = f;
+        ret->ctx.arg   = arg;
+        ret->ctx.stack = stack;
+        ret->ctx.size  = stack_size;
+        context_init(&(ret->state), &(ret->ctx));
+
+        task_place(ret, task_balance(ret->affinity));
     }
 
     return (ret);
 }
 
+extern struct vrm_task *
+vrm_task_create(void (*f)(void *), void *arg, uint8_t priority)
+{
+    return vrm_task_create_ex(f, arg, priority, CONFIG_STACK_SIZE);
+}
+
+static void
+task_delete(struct runq *rq, struct vrm_task *t)
+{
+    task_unsleep(t);
+    task_remove(rq, t);
+    vrm_mem_del(t->ctx.stack);
+    vrm_slab_free(task_cache, t);
+}
+
 extern struct vrm_task *
 vrm_task_remove(struct vrm_task *t)
 {
-    if (t)
-    {
-        task_remove(t);
+    struct vrm_task *ret = NULL;
+    struct vrm_task *self = task_self();
 
-        if (current && current == t)
-            current = NULL;
+    if (t && t != self)
+    {
+        uint32_t flags = 0;
+        struct runq *rq = task_lock(t, &flags);
+
+        /* Kept while parked, as freeing its stack would leave the wait
+         * queue pointing into it */
+        uint32_t kick = 0;
+        if (t->parked)
+            ret = t;
+        /* Running elsewhere, so its core frees it when switching,
+         * or being woken, so the tick does */
+        else if (t->running || t->waking)
+        {
+            t->status = VRM_TASK_DELETED;
+            kick = task_stale(rq);
+        }
+        else
+            task_delete(rq, t);
 
-        vrm_mem_del(t);
+        vrm_spin_irqrestore(&(rq->lock), flags);
+        gic_sgi_mask(SMP_SGI_RESCHED, kick);
     }
-    else
+    else if (self)
     {
-        current->status = VRM_TASK_DELETED;
+        self->status = VRM_TASK_DELETED;
         vrm_task_yield();
     }
 
-    return NULL;
+    return ret;
+}
+
+extern struct vrm_task *
+vrm_task_self(void)
+{
+    return task_self();
 }
 
+/* State changes move the task between the lists of its queue,
+ * rescheduling its core when they leave it running the wrong task */
+
 extern bool
 vrm_task_block(struct vrm_task *t)
 {
     bool ret = false;
 
-    t = (!t) ? current : t;
-    if (t && (t->status == VRM_TASK_READY ||
-              t->status == VRM_TASK_BLOCKED))
+    t = (!t) ? task_self() : t;
+    if (t)
     {
-        t->status = VRM_TASK_BLOCKED;
-        ret = true;
+        uint32_t flags = 0;
+        struct runq *rq = task_lock(t, &flags);
+
+        ret = (t->status == VRM_TASK_READY ||
+               t->status == VRM_TASK_BLOCKED);
+        if (ret)
+        {
+            task_remove(rq, t);
+            t->status = VRM_TASK_BLOCKED;
+            task_insert(rq, t);
+        }
+
+        uint32_t kick = task_stale(rq);
+        vrm_spin_irqrestore(&(rq->lock), flags);
+        gic_sgi_mask(SMP_SGI_RESCHED, kick);
     }
 
     return ret;
@@ -236,10 +685,50 @@ vrm_task_unblock(struct vrm_task *t)
 {
     bool ret = false;
 
-    t = (!t) ? current : t;
-    if (t && t->status == VRM_TASK_BLOCKED)
+    t = (!t) ? task_self() : t;
+    if (t)
     {
-        t->status = VRM_TASK_READY;
+        uint32_t flags = 0;
+        struct runq *rq = task_lock(t, &flags);
+
+        ret = (t->status == VRM_TASK_BLOCKED);
+        if (ret)
+        {
+            task_unsleep(t);
+            task_remove(rq, t);
+            t->status = VRM_TASK_READY;
+            task_insert(rq, t);
+        }
+
+        uint32_t kick = task_stale(rq);
+        vrm_spin_irqrestore(&(rq->lock), flags);
+        gic_sgi_mask(SMP_SGI_RESCHED, kick);
+    }
+
+    if (ret)
+        task_migrate(t);
+
+    return ret;
+}
+
+static bool
+task_suspension(struct vrm_task *t, bool suspended)
+{
+    bool ret = false;
+
+    t = (!t) ? task_self() : t;
+    if (t)
+    {
+        uint32_t flags = 0;
+        struct runq *rq = task_lock(t, &flags);
+
+        task_remove(rq, t);
+        t->suspended = suspended;
+        task_insert(rq, t);
+
+        uint32_t kick = task_stale(rq);
+        vrm_spin_irqrestore(&(rq->lock), flags);
+        gic_sgi_mask(SMP_SGI_RESCHED, kick);
         ret = true;
     }
 
@@ -248,127 +737,513 @@ vrm_task_unblock(struct vrm_task *t)
 
 extern bool
 vrm_task_suspend(struct vrm_task *t)
+{
+    return task_suspension(t, true);
+}
+
+extern bool
+vrm_task_resume(struct vrm_task *t)
+{
+    return task_suspension(t, false);
+}
+
+static uint32_t
+task_rank(struct runq *rq, struct vrm_task *t)
+{
+    task_remove(rq, t);
+    t->priority = (t->inherit > t->base) ? t->inherit : t->base;
+    task_insert(rq, t);
+
+    return task_stale(rq);
+}
+
+extern bool
+vrm_task_priority(struct vrm_task *t, uint8_t priority)
 {
     bool ret = false;
 
-    t = (!t) ? current : t;
-    if (t)
+    t = (!t) ? task_self() : t;
+    if (t && priority < 32)
     {
-        t->suspended = true;
-        ret          = true;
+        uint32_t flags = 0;
+        struct runq *rq = task_lock(t, &flags);
+        t->base = priority;
+        uint32_t kick = task_rank(rq, t);
+        vrm_spin_irqrestore(&(rq->lock), flags);
+
+        gic_sgi_mask(SMP_SGI_RESCHED, kick);
+        ret = true;
     }
 
     return ret;
 }
 
+/* Priority inheritance, for the mutexes */
+
+extern uint8_t
+task_level(struct vrm_task *t)
+{
+    return (t) ? t->priority : 0;
+}
+
+extern void
+task_inherit(struct vrm_task *t, uint8_t priority)
+{
+    if (t && priority < 32)
+    {
+        uint32_t flags = 0;
+        struct runq *rq = task_lock(t, &flags);
+
+        uint32_t kick = 0;
+        if (priority > t->inherit)
+        {
+            t->inherit = priority;
+            kick = task_rank(rq, t);
+        }
+
+        vrm_spin_irqrestore(&(rq->lock), flags);
+        gic_sgi_mask(SMP_SGI_RESCHED, kick);
+    }
+}
+
 extern bool
-vrm_task_resume(struct vrm_task *t)
+task_park(struct vrm_task *t, bool parked)
 {
     bool ret = false;
 
-    t = (!t) ? current : t;
     if (t)
     {
-        t->suspended = false;
-        ret          = true;
+        uint32_t flags = 0;
+        struct runq *rq = task_lock(t, &flags);
+
+        /* Not once removed, as it would be freed with its waiter linked */
+        ret = !parked || t->status != VRM_TASK_DELETED;
+        if (ret)
+            t->parked = parked;
+
+        vrm_spin_irqrestore(&(rq->lock), flags);
     }
 
     return ret;
 }
 
+extern void
+task_hold(struct vrm_task *t, bool held)
+{
+    if (t)
+    {
+        uint32_t flags = 0;
+        struct runq *rq = task_lock(t, &flags);
+
+        t->held = (held) ? t->held + 1 : t->held - 1;
+
+        uint32_t kick = 0;
+        if (!(t->held) && t->inherit)
+        {
+            t->inherit = 0;
+            kick = task_rank(rq, t);
+        }
+
+        vrm_spin_irqrestore(&(rq->lock), flags);
+        gic_sgi_mask(SMP_SGI_RESCHED, kick);
+    }
+}
+
 extern bool
-vrm_task_priority(struct vrm_task *t, uint8_t priority)
+vrm_task_affinity(struct vrm_task *t, uint32_t cores)
 {
     bool ret = false;
 
-    t = (!t) ? current : t;
-    if (t)
+    t = (!t) ? task_self() : t;
+    cores &= CORES_ALL;
+    if (t && cores)
     {
-        task_remove(t);
-        t->priority = priority;
-        task_insert(t);
+        t->affinity = cores;
+        if (!(cores & (1 << t->core)))
+            task_migrate(t);
         ret = true;
     }
 
     return ret;
 }
 
+extern size_t
+vrm_task_stack_usage(struct vrm_task *t)
+{
+    size_t ret = 0;
+
+#ifdef CONFIG_TASK_STACK_PAINT
+    /* Stacks grow down, so paint left at the bottom was never reached */
+    t = (!t) ? task_self() : t;
+    if (t)
+    {
+        uint32_t *words = (uint32_t *)t->ctx.stack;
+        size_t count = t->ctx.size / sizeof(uint32_t);
+
+        size_t i = 0;
+        while (i < count && words[i] == STACK_PAINT)
+            i++;
+
+        ret = t->ctx.size - (i * sizeof(uint32_t));
+    }
+#else
+    (void)t;
+#endif
+
+    return ret;
+}
+
+static bool
+task_system(void)
+{
+    /* Where tasks and the scheduler loop run, unlike interrupts */
+    uint32_t cpsr = 0;
+    __asm__ __volatile__ ("mrs %0, cpsr" : "=r"(cpsr));
+    return (cpsr & 0x1F) == CPSR_SYS;
+}
+
 extern void
 vrm_task_yield(void)
 {
-    gic_wait();
+    /* Switches right away from system mode, while anything else waits
+     * for an interrupt */
+    if (task_system())
+        __asm__ __volatile__ ("svc #0" ::: "memory");
+    else
+        gic_wait();
 }
 
-static void
-task_next(void)
+extern uint64_t
+vrm_task_clock(void)
 {
-    task_remove(current);
-    task_insert(current);
+    return task_clock();
+}
+
+extern bool
+task_block_until(uint64_t deadline)
+{
+    bool ret = false;
 
-    bool found = false;
-    for (uint8_t i = 0; !found && i < 32; i++)
+    /* Still running, so it's filed as blocked when switched out */
+    struct vrm_task *self = (task_system()) ? task_self() : NULL;
+    if (self && deadline > task_clock())
     {
-        uint8_t j = 32 - i - 1;
+        uint32_t flags = 0;
+        struct runq *rq = task_lock(self, &flags);
 
-        current = heads[j];
-        while (current && !found)
+        ret = (self->status == VRM_TASK_READY);
+        if (ret)
         {
-            switch (current->status)
-            {
-                case VRM_TASK_NEW:
-                case VRM_TASK_READY:
-                    found = true;
-                    break;
-
-                case VRM_TASK_DELETED:
-                    vrm_task_remove(current);
-                    break;
-
-                default:
-                    break;
-            }
-
-            if (!found)
-                current = current->next;
+            self->status = VRM_TASK_BLOCKED;
+
+            vrm_spin_lock(&(tick.lock));
+            tick_sleep(self, deadline);
+            vrm_spin_unlock(&(tick.lock));
         }
+
+        /* Switched out once IRQs are unmasked, by the caller if it
+         * still holds the object it waits on */
+        uint32_t kick = task_stale(rq);
+        vrm_spin_irqrestore(&(rq->lock), flags);
+        gic_sgi_mask(SMP_SGI_RESCHED, kick);
     }
+
+    return ret;
 }
 
+extern bool
+vrm_task_sleep_until(uint64_t deadline)
+{
+    bool ret = false;
+
+    /* Only tasks sleep, not the interrupts that preempt them */
+    if (task_system() && task_self())
+    {
+        /* The reschedule it sent may still be pending, so this switches
+         * out either way, and only comes back once woken */
+        task_block_until(deadline);
+        vrm_task_yield();
+        ret = true;
+    }
+
+    return ret;
+}
+
+extern bool
+vrm_task_sleep(uint32_t us)
+{
+    return vrm_task_sleep_until(task_clock() + us);
+}
+
+/* Scheduling */
+
+static struct vrm_task *
+task_pick(struct runq *rq, uint8_t core)
+{
+    struct vrm_task *ret = NULL;
+
+    /* Highest ready priority first, its head unless pinned elsewhere */
+    uint32_t bitmap = rq->bitmap;
+    while (!ret && bitmap)
+    {
+        uint8_t i = 31 - __builtin_clz(bitmap);
+        for (struct vrm_task *t = rq->ready[i].head; t && !ret; t = t->next)
+        {
+            if (t->affinity & (1 << core))
+                ret = t;
+        }
+
+        bitmap &= ~(1U << i);
+    }
+
+    /* Marked as running right away, so no other core steals it */
+    if (ret)
+    {
+        task_remove(rq, ret);
+        ret->running = true;
+    }
+
+    return ret;
+}
+
+static struct vrm_task *
+task_steal(uint8_t core)
+{
+    struct vrm_task *ret = NULL;
+    struct runq *rq = &(runqs[core]);
+
+    /* Taken over with both queues held, so the task always has one */
+    for (uint8_t i = 1; !ret && i < SMP_CORES; i++)
+    {
+        uint8_t other = (core + i) % SMP_CORES;
+        if (active & (1 << other))
+        {
+            struct runq *from = &(runqs[other]);
+            uint32_t flags = task_lock_both(from, rq);
+            ret = task_pick(from, core);
+            if (ret)
+                ret->core = core;
+            task_unlock_both(from, rq, flags);
+        }
+    }
+
+    return ret;
+}
+
+#ifdef CONFIG_TASK_STACK_PAINT
+static bool
+task_guard(struct vrm_task *t)
+{
+    /* Within the guard, or already past it with the last word written */
+    uint32_t bottom = (uint32_t)t->ctx.stack;
+    return t->state.gpr[STATE_SP] < bottom + STACK_GUARD ||
+           *(uint32_t *)t->ctx.stack != STACK_PAINT;
+}
+#endif
+
 static void
-task_preempt(void *arg)
+task_switch(void *arg)
 {
     (void)arg;
 
-    if (current)
-        state_save_irq(&(current->caller));
+    uint8_t core = smp_core();
+    uint32_t *frame = gic_irq_regs[core];
+    struct runq *rq = &(runqs[core]);
 
-    task_next();
+    uint32_t flags = vrm_spin_irqsave(&(rq->lock));
 
-    if (current)
+    /* Back to the tail of its list, round robin inside the priority */
+    struct vrm_task *prev = rq->current;
+    struct vrm_task *caught = NULL;
+    bool pinned = false;
+    if (prev)
     {
-        switch (current->status)
-        {
-            case VRM_TASK_NEW:
-                current->status = VRM_TASK_READY;
-                context_run_irq(&(current->ctx));
-                break;
+        state_save(&(prev->state), frame);
+        prev->running = false;
 
-            case VRM_TASK_READY:
-                state_load_irq(&(current->caller));
-                break;
+#ifdef CONFIG_TASK_STACK_PAINT
+        /* Suspended before it can overflow into its neighbours */
+        if (prev->status != VRM_TASK_DELETED && task_guard(prev))
+        {
+            prev->suspended = true;
+            caught = prev;
+        }
+#endif
 
-            default:
-                break;
+        if (prev->status == VRM_TASK_DELETED)
+        {
+            if (!(prev->waking))
+                task_delete(rq, prev);
+        }
+        else
+        {
+            task_insert(rq, prev);
+            pinned = !(prev->affinity & (1 << core));
         }
     }
+    else
+        state_save(&(rq->idle), frame);
+    rq->current = NULL;
+
+    struct vrm_task *next = task_pick(rq, core);
+    vrm_spin_irqrestore(&(rq->lock), flags);
+
+    if (caught)
+        vrm_debug("Task ~p suspended, stack near overflow", caught);
+
+    /* Pinned away from this core while it was running */
+    if (pinned)
+        task_migrate(prev);
+
+    if (!next)
+        next = task_steal(core);
+
+    flags = vrm_spin_irqsave(&(rq->lock));
+    if (next)
+    {
+        if (next->status == VRM_TASK_NEW)
+            next->status = VRM_TASK_READY;
+
+        state_load(&(next->state), frame);
+    }
+    else
+        state_load(&(rq->idle), frame);
+
+    /* Blocked or suspended between the pick and now, with no current
+     * task yet for that change to reschedule */
+    bool stale = next && (next->suspended ||
+                          next->status != VRM_TASK_READY);
+
+    rq->current = next;
+    task_slice(rq);
+    vrm_spin_irqrestore(&(rq->lock), flags);
+
+    if (stale)
+        gic_sgi_core(SMP_SGI_RESCHED, core);
 }
 
-extern void
-vrm_task_scheduler(uint8_t timer, uint32_t us, uint32_t flags)
+static void
+task_wake(struct vrm_task *t)
 {
-    (void)flags;
+    uint32_t flags = 0;
+    struct runq *rq = task_lock(t, &flags);
+    t->waking = false;
 
-    vrm_timer_alarm(timer, us, true, task_preempt, NULL);
+    /* Unless removed meanwhile, or woken and asleep again */
+    uint32_t kick = 0;
+    if (t->status == VRM_TASK_DELETED)
+    {
+        if (!(t->running))
+            task_delete(rq, t);
+    }
+    else if (t->status == VRM_TASK_BLOCKED && !(t->wake))
+    {
+        task_remove(rq, t);
+        t->status = VRM_TASK_READY;
+        task_insert(rq, t);
+        kick = task_stale(rq);
+    }
+
+    vrm_spin_irqrestore(&(rq->lock), flags);
+    gic_sgi_mask(SMP_SGI_RESCHED, kick);
+}
+
+static void
+task_tick(void *arg)
+{
+    uint32_t flags = vrm_spin_irqsave(&(tick.lock));
+#ifndef CONFIG_ARM_COUNTER
+    tick.now = tick.alarm;
+#endif
+    uint64_t now = task_clock();
+    tick.alarm = 0;
+
+    /* Expired sleeps, marked so they aren't freed until woken */
+    struct vrm_task *woken = NULL;
+    while (tick.sleeping && tick.sleeping->wake <= now)
+    {
+        struct vrm_task *t = tick.sleeping;
+        tick.sleeping = t->sleep_next;
+
+        t->wake       = 0;
+        t->waking     = true;
+        t->sleep_next = NULL;
+        t->wake_next  = woken;
+        woken         = t;
+    }
+
+    /* Every core when ticking, only the ones sharing when tickless */
+    uint32_t cores = 0;
+    if (tick.slice && tick.slice <= now)
+    {
+        cores = (tick.tickless) ? tick.cores : active;
+        tick.slice = (cores) ? now + tick.us : 0;
+    }
+
+    tick_arm();
+    vrm_spin_irqrestore(&(tick.lock), flags);
+
+    while (woken)
+    {
+        struct vrm_task *next = woken->wake_next;
+        woken->wake_next = NULL;
+        task_wake(woken);
+        woken = next;
+    }
+
+    /* The timer only interrupts this core, the others get an SGI */
+    uint32_t self = 1 << smp_core();
+    gic_sgi_mask(SMP_SGI_RESCHED, cores & active & ~self);
+    if (cores & self)
+        task_switch(arg);
+}
+
+static void
+task_join(void *arg)
+{
+    (void)arg;
+
+    /* This loop is what a core goes back to with nothing to run,
+     * in system mode like the tasks so it can yield as they do */
+    gic_system();
+    vrm_atomic_add(&active, 1 << smp_core());
+    gic_state(true);
+
+    /* Tasks placed before the core was active sent no reschedule */
+    gic_sgi_core(SMP_SGI_RESCHED, smp_core());
     while (true)
         gic_wait();
 }
+
+extern void
+vrm_task_scheduler(uint8_t timer, uint32_t us, uint32_t flags)
+{
+    tick.timer    = timer;
+    tick.us       = us;
+    tick.tickless = flags & VRM_TASK_TICKLESS;
+
+    gic_sgi_handler(SMP_SGI_RESCHED, task_switch, NULL);
+    gic_svc_handler(task_switch, NULL);
+
+#ifdef CONFIG_ARM_SMP
+    for (uint8_t i = 0; i < SMP_CORES; i++)
+    {
+        if (i != smp_core() && smp_online(i))
+            smp_call(i, task_join, NULL);
+    }
+#endif
+
+    /* The handler is set once here, without the alarm running, so the
+     * rearms done under the tick lock never reconfigure the GIC */
+    vrm_timer_alarm(timer, 0, false, task_tick, NULL);
+
+    /* Slices end on a one-shot alarm either way, so it can be pulled
+     * in for sleeps; ticking they just never stop */
+    uint32_t irq = vrm_spin_irqsave(&(tick.lock));
+    if (!(tick.tickless))
+        tick.slice = task_clock() + us;
+    tick_arm();
+    vrm_spin_irqrestore(&(tick.lock), irq);
+
+    task_join(NULL);
+}
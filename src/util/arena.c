@@ -0,0 +1,124 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <vermillion/util/mem.h>
+#include <vermillion/util/arena.h>
+#include <vermillion/util/types.h>
+
+#define ARENA_ALIGN 8
+
+/* Chained when the first block runs out */
+struct chunk
+{
+    struct chunk *next;
+    size_t size;
+};
+
+/* The first block follows the arena itself */
+struct vrm_arena
+{
+    size_t size;
+    struct chunk *chunks;
+    uint32_t top, end;
+};
+
+/* Largest size that still fits with its header after rounding up */
+#define ARENA_LIMIT(header) (SIZE_MAX - sizeof(header) - (ARENA_ALIGN - 1))
+
+extern struct vrm_arena *
+vrm_arena_create(size_t size)
+{
+    struct vrm_arena *ret = NULL;
+
+    if (size <= ARENA_LIMIT(struct vrm_arena))
+    {
+        size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+        ret = vrm_mem_new(sizeof(struct vrm_arena) + size);
+    }
+
+    if (ret)
+    {
+        ret->size   = size;
+        ret->chunks = NULL;
+        vrm_arena_reset(ret);
+    }
+
+    return ret;
+}
+
+extern struct vrm_arena *
+vrm_arena_destroy(struct vrm_arena *a)
+{
+    if (a)
+    {
+        vrm_arena_reset(a);
+        vrm_mem_del(a);
+    }
+
+    return NULL;
+}
+
+extern void *
+vrm_arena_alloc(struct vrm_arena *a, size_t size)
+{
+    void *ret = NULL;
+
+    if (a && size <= ARENA_LIMIT(struct chunk))
+    {
+        size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+        if (size > a->end - a->top)
+        {
+            size_t bytes = (size > a->size) ? size : a->size;
+
+            struct chunk *c = vrm_mem_new(sizeof(struct chunk) + bytes);
+            if (c)
+            {
+                c->next   = a->chunks;
+                c->size   = bytes;
+                a->chunks = c;
+
+                a->top = (uint32_t)&(c[1]);
+                a->end = a->top + bytes;
+            }
+        }
+
+        if (size <= a->end - a->top)
+        {
+            ret = (void *)a->top;
+            a->top += size;
+        }
+    }
+
+    return ret;
+}
+
+extern void
+vrm_arena_reset(struct vrm_arena *a)
+{
+    if (a)
+    {
+        while (a->chunks)
+        {
+            struct chunk *next = a->chunks->next;
+            vrm_mem_del(a->chunks);
+            a->chunks = next;
+        }
+
+        a->top = (uint32_t)&(a[1]);
+        a->end = a->top + a->size;
+    }
+}
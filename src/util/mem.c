@@ -15,29 +15,230 @@
 */
 
 #define VERMILLION_INTERNALS
+#ifdef CONFIG_MEM_TRACE
+#ifdef CONFIG_ARM_COUNTER
+#include <arch/counter.h>
+#endif
+#endif
+
+#include <vermillion/sys/spin.h>
+#include <vermillion/sys/task.h>
 #include <vermillion/util/mem.h>
 #include <vermillion/util/types.h>
 
+/* Two-level segregated fit allocator */
+
+#define MEM_ALIGN 8
+#define MEM_LINE  64
+
+#define SL_LOG2  4
+#define SL_COUNT (1 << SL_LOG2)
+#define FL_SHIFT (SL_LOG2 + 3)
+#define FL_COUNT (32 - FL_SHIFT + 1)
+#define FL_SMALL (1 << FL_SHIFT)
+
 struct memblk
 {
+    struct memblk *prev;
     uint32_t size;
-    struct memblk *next;
+
+#ifdef CONFIG_MEM_TRACE
+    /* Owner of the block, kept a multiple of 8 bytes */
+    struct vrm_task *task;
+    void *caller;
+    uint64_t time;
+#endif
+
+    /* Only valid while the block is free */
+    struct memblk *next_free, *prev_free;
 };
 
-#define MEMBODY(addr, offset) \
-((void *)((uint32_t)(addr) + (offset) + sizeof(struct memblk)))
+#define BLK_FREE (1 << 0)
+
+#define MEMHEAD offsetof(struct memblk, next_free)
+#define MEM_MIN (sizeof(struct memblk) - MEMHEAD)
+#define MEMSIZE(blk) ((blk)->size & ~(MEM_ALIGN - 1))
+#define MEMBODY(blk) ((void *)((uint32_t)(blk) + MEMHEAD))
+#define MEMNEXT(blk) ((struct memblk *)((uint32_t)MEMBODY(blk) + MEMSIZE(blk)))
+#define MEMBLK(mem)  ((struct memblk *)((uint32_t)(mem) - MEMHEAD))
+
+static uint32_t fl_map = 0;
+static uint32_t sl_map[FL_COUNT] = {0};
+static struct memblk *lists[FL_COUNT][SL_COUNT] = {{NULL}};
+static size_t mem_free = 0;
+
+/* Held with IRQs masked, so handlers can allocate as well */
+static vrm_spin mem_lock = VRM_SPIN_INIT;
+
+/* Statistics, kept up to date as blocks change hands */
+static size_t mem_blocks = 0;
+static size_t mem_used = 0, mem_count = 0, mem_peak = 0;
+static uint32_t mem_allocs = 0, mem_frees = 0;
+static uint32_t mem_histogram[32] = {0};
+
+static void
+mem_mapping(size_t size, uint8_t *fl, uint8_t *sl)
+{
+    if (size < FL_SMALL)
+    {
+        *fl = 0;
+        *sl = size / (FL_SMALL / SL_COUNT);
+    }
+    else
+    {
+        uint8_t f = 31 - __builtin_clz(size);
+        *sl = (size >> (f - SL_LOG2)) ^ SL_COUNT;
+        *fl = f - FL_SHIFT + 1;
+    }
+}
+
+static void
+mem_insert(struct memblk *blk)
+{
+    uint8_t fl = 0, sl = 0;
+    mem_mapping(MEMSIZE(blk), &fl, &sl);
+
+    blk->size |= BLK_FREE;
+    blk->prev_free = NULL;
+    blk->next_free = lists[fl][sl];
+    if (blk->next_free)
+        blk->next_free->prev_free = blk;
+    lists[fl][sl] = blk;
+
+    fl_map     |= 1 << fl;
+    sl_map[fl] |= 1 << sl;
+    mem_free   += MEMSIZE(blk);
+
+    mem_blocks++;
+    if (MEMSIZE(blk))
+        mem_histogram[31 - __builtin_clz(MEMSIZE(blk))]++;
+}
+
+static void
+mem_remove(struct memblk *blk)
+{
+    uint8_t fl = 0, sl = 0;
+    mem_mapping(MEMSIZE(blk), &fl, &sl);
+
+    if (blk->next_free)
+        blk->next_free->prev_free = blk->prev_free;
+    if (blk->prev_free)
+        blk->prev_free->next_free = blk->next_free;
+    else
+    {
+        lists[fl][sl] = blk->next_free;
+        if (!(lists[fl][sl]))
+        {
+            sl_map[fl] &= ~(1 << sl);
+            if (!(sl_map[fl]))
+                fl_map &= ~(1 << fl);
+        }
+    }
+
+    blk->size &= ~BLK_FREE;
+    mem_free  -= MEMSIZE(blk);
+
+    mem_blocks--;
+    if (MEMSIZE(blk))
+        mem_histogram[31 - __builtin_clz(MEMSIZE(blk))]--;
+}
+
+static struct memblk *
+mem_find(size_t size)
+{
+    struct memblk *ret = NULL;
+
+    /* Rounds up so that any block of the class fits */
+    if (size >= FL_SMALL)
+        size += (1 << (31 - __builtin_clz(size) - SL_LOG2)) - 1;
+
+    uint8_t fl = 0, sl = 0;
+    mem_mapping(size, &fl, &sl);
+
+    if (fl < FL_COUNT)
+    {
+        uint32_t map = sl_map[fl] & (~0U << sl);
+        if (!map && fl + 1 < FL_COUNT)
+        {
+            uint32_t map2 = fl_map & (~0U << (fl + 1));
+            if (map2)
+            {
+                fl  = __builtin_ctz(map2);
+                map = sl_map[fl];
+            }
+        }
+
+        if (map)
+            ret = lists[fl][__builtin_ctz(map)];
+    }
+
+    return ret;
+}
+
+static struct memblk *
+mem_merge(struct memblk *blk)
+{
+    struct memblk *prev = blk->prev;
+    if (prev && prev->size & BLK_FREE)
+    {
+        mem_remove(prev);
+        prev->size += MEMSIZE(blk) + MEMHEAD;
+        blk = prev;
+        MEMNEXT(blk)->prev = blk;
+    }
+
+    struct memblk *next = MEMNEXT(blk);
+    if (next->size & BLK_FREE)
+    {
+        mem_remove(next);
+        blk->size += MEMSIZE(next) + MEMHEAD;
+        MEMNEXT(blk)->prev = blk;
+    }
+
+    return blk;
+}
+
+static void
+mem_account(size_t old, size_t new)
+{
+    mem_used += new;
+    mem_used -= old;
+    if (mem_used > mem_peak)
+        mem_peak = mem_used;
+}
+
+static void
+mem_split(struct memblk *blk, size_t size)
+{
+    if (MEMSIZE(blk) >= size + MEMHEAD + MEM_MIN)
+    {
+        struct memblk *rest = (void *)((uint32_t)MEMBODY(blk) + size);
+        rest->prev = blk;
+        rest->size = MEMSIZE(blk) - size - MEMHEAD;
+        MEMNEXT(rest)->prev = rest;
+
+        blk->size = size;
+        mem_insert(mem_merge(rest));
+    }
+}
 
 /* For devtree usage */
 
 extern struct memblk __free;
-static struct memblk *head = NULL;
 extern void
 mem_init(void)
 {
-    head = &__free;
-    head->size = (CONFIG_RAM_ADDRESS + CONFIG_RAM_SIZE +
-                  CONFIG_STACK_SIZE  - (uint32_t)MEMBODY(head, 0));
-    head->next = NULL;
+    struct memblk *first = &__free;
+    uint32_t end = CONFIG_RAM_ADDRESS + CONFIG_RAM_SIZE;
+
+    /* A zero-sized block in use closes the heap */
+    first->prev = NULL;
+    first->size = (end - (uint32_t)first - (2 * MEMHEAD)) & ~(MEM_ALIGN - 1);
+    struct memblk *last = MEMNEXT(first);
+    last->prev = first;
+    last->size = 0;
+
+    mem_insert(first);
 }
 
 extern void
@@ -46,54 +247,113 @@ mem_clean(void)
     return;
 }
 
-/* For external usage */
+static void
+mem_trace(struct memblk *blk, void *caller)
+{
+#ifdef CONFIG_MEM_TRACE
+    blk->task   = vrm_task_self();
+    blk->caller = caller;
+#ifdef CONFIG_ARM_COUNTER
+    blk->time   = counter_read();
+#else
+    blk->time   = 0;
+#endif
+#else
+    (void)blk, (void)caller;
+#endif
+}
 
-extern void *
-vrm_mem_new(size_t size)
+static void *
+mem_alloc(size_t size, size_t align, void *caller)
 {
     void *ret = NULL;
 
-    size = (size >= 16) ? size : 16;
-
-    struct memblk *blk = NULL, *prev = NULL;
-    for (struct memblk *cur = head; cur != NULL; cur = cur->next)
+    uint32_t flags = vrm_spin_irqsave(&mem_lock);
+    if (size < 0x80000000 && align < 0x40000000 && !(align & (align - 1)))
     {
-        if ((size_t)(cur->size) >= size)
+        size = (size >= MEM_MIN) ? size : MEM_MIN;
+        size = (size + MEM_ALIGN - 1) & ~(MEM_ALIGN - 1);
+        align = (align > MEM_ALIGN) ? align : 0;
+
+        /* A leading gap must be able to stand as a free block */
+        size_t gap_min = MEMHEAD + MEM_MIN;
+        struct memblk *blk = mem_find((align) ? size + align + gap_min : size);
+        if (blk)
         {
-            blk = cur;
-            break;
+            mem_remove(blk);
+
+            uint32_t body = (uint32_t)MEMBODY(blk);
+            uint32_t gap  = (align) ? ((body + align - 1) & ~(align - 1)) - body
+                                    : 0;
+            while (gap && gap < gap_min)
+                gap += align;
+
+            if (gap)
+            {
+                struct memblk *aligned = MEMBLK(body + gap);
+                aligned->prev = blk;
+                aligned->size = MEMSIZE(blk) - gap;
+                MEMNEXT(aligned)->prev = aligned;
+
+                blk->size = gap - MEMHEAD;
+                mem_insert(mem_merge(blk));
+                blk = aligned;
+            }
+
+            mem_split(blk, size);
+            mem_trace(blk, caller);
+            ret = MEMBODY(blk);
+
+            mem_account(0, MEMSIZE(blk));
+            mem_count++;
+            mem_allocs++;
         }
-        prev = cur;
     }
+    vrm_spin_irqrestore(&mem_lock, flags);
+
+    return ret;
+}
 
-    if (blk)
+static void
+mem_release(struct memblk *blk)
+{
+    if (!(blk->size & BLK_FREE))
     {
-        if (blk->size >= (16 + size + sizeof(struct memblk)))
-        {
-            struct memblk *new = MEMBODY(blk, size);
-            new->size = (blk->size - size - sizeof(struct memblk));
-            new->next = blk->next;
+        mem_account(MEMSIZE(blk), 0);
+        mem_count--;
+        mem_frees++;
 
-            if (prev != NULL)
-                prev->next = new;
-            else
-                head = new;
+        mem_insert(mem_merge(blk));
+    }
+}
 
-            blk->size = size;
-        }
-        else
-        {
-            if (prev != NULL)
-                prev->next = blk->next;
-            else
-                head = blk->next;
-        }
-        blk->next = NULL;
+/* For external usage */
+
+extern void *
+vrm_mem_new(size_t size)
+{
+    return mem_alloc(size, 0, __builtin_return_address(0));
+}
 
-        ret = MEMBODY(blk, 0);
+extern void *
+vrm_mem_new_aligned(size_t size, size_t align)
+{
+    return mem_alloc(size, align, __builtin_return_address(0));
+}
+
+extern void *
+vrm_mem_new_flags(size_t size, uint32_t flags)
+{
+    size_t align = 0;
+
+    /* Whole lines, so maintenance never touches a neighbour */
+    if (flags & (VRM_MEM_DMA | VRM_MEM_UNCACHED))
+    {
+        align = MEM_LINE;
+        size  = (size + MEM_LINE - 1) & ~(MEM_LINE - 1);
     }
 
-    return ret;
+    return mem_alloc(size, align, __builtin_return_address(0));
 }
 
 extern void *
@@ -101,81 +361,230 @@ vrm_mem_del(void *mem)
 {
     if (mem != NULL)
     {
-        struct memblk *blk = mem;
-        blk = &(blk[-1]);
+        uint32_t flags = vrm_spin_irqsave(&mem_lock);
+        mem_release(MEMBLK(mem));
+        vrm_spin_irqrestore(&mem_lock, flags);
+    }
+
+    return NULL;
+}
+
+extern void *
+vrm_mem_resize(void *mem, size_t size)
+{
+    void *ret = NULL;
+
+    if (size == 0)
+        ret = vrm_mem_del(mem);
+    else if (mem == NULL)
+        ret = vrm_mem_new(size);
+    else if (size < 0x80000000)
+    {
+        uint32_t flags = vrm_spin_irqsave(&mem_lock);
+
+        struct memblk *blk = MEMBLK(mem);
+        size_t old = MEMSIZE(blk);
 
-        struct memblk *prev = NULL;
-        if (blk < head || !head)
+        size_t need = (size >= MEM_MIN) ? size : MEM_MIN;
+        need = (need + MEM_ALIGN - 1) & ~(MEM_ALIGN - 1);
+
+        /* Grows over the physically next block when it's free */
+        struct memblk *next = MEMNEXT(blk);
+        if (need > old && next->size & BLK_FREE &&
+            old + MEMHEAD + MEMSIZE(next) >= need)
         {
-            blk->next = head;
-            head      = blk;
+            mem_remove(next);
+            blk->size += MEMSIZE(next) + MEMHEAD;
+            MEMNEXT(blk)->prev = blk;
         }
-        else
+
+        if (MEMSIZE(blk) >= need)
         {
-            for (struct memblk *cur = head; cur != NULL; cur = cur->next)
-            {
-                if (blk < cur)
-                {
-                    blk->next  = prev->next;
-                    prev->next = blk;
-                    break;
-                }
+            mem_split(blk, need);
+            mem_account(old, MEMSIZE(blk));
+            ret = mem;
+        }
 
-                prev = cur;
-            }
+        vrm_spin_irqrestore(&mem_lock, flags);
 
-            if (!(blk->next))
-                prev->next = blk;
+        if (!ret)
+        {
+            /* The original stays valid when this fails */
+            ret = mem_alloc(size, 0, __builtin_return_address(0));
+            if (ret)
+            {
+                vrm_mem_copy(ret, mem, old);
+                vrm_mem_del(mem);
+            }
         }
+    }
+
+    return ret;
+}
+
+extern void
+vrm_mem_use(size_t *free, size_t *total)
+{
+    if (free)
+        *free = mem_free;
+
+    if (total)
+        *total = CONFIG_RAM_SIZE;
+}
+
+extern void
+vrm_mem_stats(vrm_mem_info *info)
+{
+    if (info)
+    {
+        uint32_t flags = vrm_spin_irqsave(&mem_lock);
+
+        info->free  = mem_free;
+        info->total = CONFIG_RAM_SIZE;
 
-        if (prev)
+        /* Only the highest non-empty class can hold the largest block */
+        info->largest = 0;
+        if (fl_map)
         {
-            struct memblk *next = MEMBODY(prev, prev->size);
-            if (next == blk)
+            uint8_t fl = 31 - __builtin_clz(fl_map);
+            uint8_t sl = 31 - __builtin_clz(sl_map[fl]);
+            for (struct memblk *blk = lists[fl][sl]; blk;
+                 blk = blk->next_free)
             {
-                prev->size += blk->size + sizeof(struct memblk);
-                prev->next  = blk->next;
-                blk = prev;
+                if (MEMSIZE(blk) > info->largest)
+                    info->largest = MEMSIZE(blk);
             }
         }
+        info->blocks = mem_blocks;
+
+        info->used   = mem_used;
+        info->count  = mem_count;
+        info->peak   = mem_peak;
+        info->allocs = mem_allocs;
+        info->frees  = mem_frees;
+        vrm_mem_copy(info->histogram, mem_histogram, sizeof(mem_histogram));
+
+        vrm_spin_irqrestore(&mem_lock, flags);
+    }
+}
+
+extern void
+vrm_mem_walk(bool (*f)(const vrm_mem_block *, void *), void *arg)
+{
+    uint32_t flags = vrm_spin_irqsave(&mem_lock);
 
-        struct memblk *next = MEMBODY(blk, blk->size);
-        if (blk->next == next)
+    /* Address order, up to the zero-sized block closing the heap */
+    bool stop = (f == NULL);
+    for (struct memblk *blk = &__free; !stop && MEMSIZE(blk) != 0;
+         blk = MEMNEXT(blk))
+    {
+        if (!(blk->size & BLK_FREE))
         {
-            blk->size += next->size + sizeof(struct memblk);
-            blk->next  = next->next;
+            vrm_mem_block b = {.mem = MEMBODY(blk), .size = MEMSIZE(blk)};
+#ifdef CONFIG_MEM_TRACE
+            b.task   = blk->task;
+            b.caller = blk->caller;
+            b.time   = blk->time;
+#endif
+
+            stop = !(f(&b, arg));
         }
     }
 
-    return NULL;
+    vrm_spin_irqrestore(&mem_lock, flags);
 }
 
-extern void
-vrm_mem_use(size_t *free, size_t *total)
+struct aggregate
 {
-    if (free)
+    vrm_mem_group *groups;
+    size_t count, used;
+    enum vrm_mem_key key;
+};
+
+static bool
+mem_aggregate(const vrm_mem_block *b, void *arg)
+{
+    struct aggregate *ag = arg;
+
+    const void *key = (ag->key == VRM_MEM_BY_TASK) ? (void *)b->task
+                                                   : b->caller;
+
+    size_t i = 0;
+    while (i < ag->used && ag->groups[i].key != key)
+        i++;
+
+    if (i == ag->used && i < ag->count)
     {
-        *free = 0;
-        for (struct memblk *cur = head; cur != NULL; cur = cur->next)
-            *free += cur->size;
+        ag->groups[i].key   = key;
+        ag->groups[i].bytes = 0;
+        ag->groups[i].count = 0;
+        ag->used++;
     }
 
-    if (total)
-        *total = CONFIG_RAM_SIZE;
+    /* Groups past the end of the array are left out */
+    if (i < ag->used)
+    {
+        ag->groups[i].bytes += b->size;
+        ag->groups[i].count++;
+    }
+
+    return true;
 }
 
+extern size_t
+vrm_mem_aggregate(vrm_mem_group *groups, size_t count, enum vrm_mem_key key)
+{
+    struct aggregate ag = {.groups = groups, .count = count, .key = key};
+
+    if (groups && count)
+        vrm_mem_walk(mem_aggregate, &ag);
+
+    return ag.used;
+}
+
+/* Word-wide helpers */
+
+typedef uint32_t __attribute__((may_alias)) memword;
+
+#define WORD_ONES  0x01010101
+#define WORD_HIGHS 0x80808080
+#define WORD_ZERO(w) (((w) - WORD_ONES) & ~(w) & WORD_HIGHS)
+
+#define MEM_BURST 32
+
 extern int
 vrm_mem_comp(const void *mem, const void *mem2, size_t length)
 {
     int ret = 0;
 
+    const uint8_t *a = mem, *b = mem2;
+    if (length >= MEM_BURST && !(((uint32_t)a ^ (uint32_t)b) & 3))
+    {
+        for (; (uint32_t)a & 3 && a[0] == b[0]; length--)
+        {
+            a = &(a[1]);
+            b = &(b[1]);
+        }
+
+        /* The mismatching word is left to the byte loop */
+        if (!((uint32_t)a & 3))
+        {
+            for (; length >= 4; length -= 4)
+            {
+                if (*(const memword *)a != *(const memword *)b)
+                    break;
+
+                a = &(a[4]);
+                b = &(b[4]);
+            }
+        }
+    }
+
     for (size_t i = 0; i < length; i++)
     {
-        uint8_t c = ((uint8_t*)mem)[i];
-        uint8_t c2 = ((uint8_t*)mem2)[i];
-        if (c != c2)
+        if (a[i] != b[i])
         {
-            ret = c - c2;
+            ret = a[i] - b[i];
             break;
         }
     }
@@ -188,12 +597,32 @@ vrm_mem_find(const void *mem, uint8_t c, size_t length)
 {
     void *ret = NULL;
 
+    const uint8_t *check = mem;
+    for (; length && (uint32_t)check & 3; length--)
+    {
+        if (check[0] == c)
+            break;
+        check = &(check[1]);
+    }
+
+    /* Aligned words never cross a page, so reading past a match is safe */
+    if (length && check[0] != c)
+    {
+        uint32_t pattern = c * WORD_ONES;
+        for (; length >= 4; length -= 4)
+        {
+            uint32_t w = *(const memword *)check ^ pattern;
+            if (WORD_ZERO(w))
+                break;
+            check = &(check[4]);
+        }
+    }
+
     for (size_t i = 0; i < length; i++)
     {
-        uint8_t *check = &(((uint8_t*)mem)[i]);
-        if (*check == c)
+        if (check[i] == c)
         {
-            ret = check;
+            ret = (void *)&(check[i]);
             break;
         }
     }
@@ -204,8 +633,48 @@ vrm_mem_find(const void *mem, uint8_t c, size_t length)
 extern void
 vrm_mem_fill(void *mem, uint8_t c, size_t length)
 {
+    uint8_t *d = mem;
+
+    if (length >= MEM_BURST)
+    {
+        for (; (uint32_t)d & 3; length--)
+        {
+            d[0] = c;
+            d = &(d[1]);
+        }
+
+        uint32_t w = c * WORD_ONES;
+        size_t bursts = length / MEM_BURST;
+        if (bursts)
+        {
+            __asm__ __volatile__ ("mov r3,  %2\n"
+                                  "mov r4,  %2\n"
+                                  "mov r5,  %2\n"
+                                  "mov r6,  %2\n"
+                                  "mov r8,  %2\n"
+                                  "mov r9,  %2\n"
+                                  "mov r10, %2\n"
+                                  "mov r12, %2\n"
+                                  "1:\n"
+                                  "stmia %0!, {r3-r6, r8-r10, r12}\n"
+                                  "subs  %1, %1, #1\n"
+                                  "bne   1b\n"
+                                  : "+r"(d), "+r"(bursts)
+                                  : "r"(w)
+                                  : "r3", "r4", "r5", "r6", "r8", "r9",
+                                    "r10", "r12", "cc", "memory");
+            length %= MEM_BURST;
+        }
+
+        for (; length >= 4; length -= 4)
+        {
+            *(memword *)d = w;
+            d = &(d[4]);
+        }
+    }
+
     for (size_t i = 0; i < length; i++)
-        ((uint8_t*)mem)[i] = c;
+        d[i] = c;
 }
 
 extern void
@@ -219,8 +688,46 @@ vrm_mem_copy(void *dest, const void *src, size_t length)
     }
     else if (dest != src)
     {
+        uint8_t *d = dest;
+        const uint8_t *s = src;
+
+        /* Bursts only when both sides can be aligned together,
+         * copying forward is safe even if dest overlaps below src */
+        if (length >= MEM_BURST && !(((uint32_t)d ^ (uint32_t)s) & 3))
+        {
+            for (; (uint32_t)d & 3; length--)
+            {
+                d[0] = s[0];
+                d = &(d[1]);
+                s = &(s[1]);
+            }
+
+            size_t bursts = length / MEM_BURST;
+            if (bursts)
+            {
+                __asm__ __volatile__ ("1:\n"
+                                      "pld   [%1, #64]\n"
+                                      "ldmia %1!, {r3-r6, r8-r10, r12}\n"
+                                      "stmia %0!, {r3-r6, r8-r10, r12}\n"
+                                      "subs  %2, %2, #1\n"
+                                      "bne   1b\n"
+                                      : "+r"(d), "+r"(s), "+r"(bursts)
+                                      :
+                                      : "r3", "r4", "r5", "r6", "r8", "r9",
+                                        "r10", "r12", "cc", "memory");
+                length %= MEM_BURST;
+            }
+
+            for (; length >= 4; length -= 4)
+            {
+                *(memword *)d = *(const memword *)s;
+                d = &(d[4]);
+                s = &(s[4]);
+            }
+        }
+
         for (size_t i = 0; i < length; i++)
-            ((uint8_t*)dest)[i] = ((uint8_t*)src)[i];
+            d[i] = s[i];
     }
 }
 
@@ -0,0 +1,203 @@
+/*
+ *  This file is part of vermillion.
+ *
+ *  Vermillion is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation, version 3.
+ *
+ *  Vermillion is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with vermillion. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <vermillion/sys/spin.h>
+#include <vermillion/util/mem.h>
+#include <vermillion/util/slab.h>
+#include <vermillion/util/types.h>
+
+#define SLAB_SIZE 0x1000
+
+struct slab
+{
+    struct slab *next;
+};
+
+struct vrm_slab
+{
+    const char *name;
+    size_t size, align;
+
+    struct slab *slabs;
+    void *objs;
+
+    size_t used, total;
+    uint32_t hits, misses;
+
+    vrm_spin lock;
+    struct vrm_slab *next;
+};
+
+static struct vrm_slab *caches = NULL;
+static vrm_spin caches_lock = VRM_SPIN_INIT;
+
+static bool
+slab_grow(struct vrm_slab *s)
+{
+    /* Page-sized, unless a single object doesn't fit */
+    size_t bytes = sizeof(struct slab) + s->align - 1 + s->size;
+    bytes = (bytes > SLAB_SIZE) ? bytes : SLAB_SIZE;
+
+    struct slab *sl = vrm_mem_new(bytes);
+    if (sl)
+    {
+        sl->next = s->slabs;
+        s->slabs = sl;
+
+        uint32_t end = (uint32_t)sl + bytes;
+        uint32_t obj = ((uint32_t)&(sl[1]) + s->align - 1) & ~(s->align - 1);
+        for (; obj + s->size <= end; obj += s->size)
+        {
+            *(void **)obj = s->objs;
+            s->objs = (void *)obj;
+            s->total++;
+        }
+    }
+
+    return (sl != NULL);
+}
+
+extern struct vrm_slab *
+vrm_slab_create(const char *name, size_t size, size_t align)
+{
+    struct vrm_slab *ret = NULL;
+
+    align = (align >= sizeof(void *)) ? align : sizeof(void *);
+    if (size && !(align & (align - 1)))
+        ret = vrm_mem_new(sizeof(struct vrm_slab));
+
+    if (ret)
+    {
+        vrm_mem_fill(ret, 0, sizeof(struct vrm_slab));
+
+        ret->name  = name;
+        ret->size  = (size + align - 1) & ~(align - 1);
+        ret->align = align;
+
+        uint32_t flags = vrm_spin_irqsave(&caches_lock);
+        ret->next = caches;
+        caches    = ret;
+        vrm_spin_irqrestore(&caches_lock, flags);
+    }
+
+    return ret;
+}
+
+extern struct vrm_slab *
+vrm_slab_destroy(struct vrm_slab *s)
+{
+    if (s)
+    {
+        uint32_t flags = vrm_spin_irqsave(&caches_lock);
+        struct vrm_slab **link = &caches;
+        while (*link && *link != s)
+            link = &((*link)->next);
+        if (*link)
+            *link = s->next;
+        vrm_spin_irqrestore(&caches_lock, flags);
+
+        while (s->slabs)
+        {
+            struct slab *next = s->slabs->next;
+            vrm_mem_del(s->slabs);
+            s->slabs = next;
+        }
+
+        vrm_mem_del(s);
+    }
+
+    return NULL;
+}
+
+extern void *
+vrm_slab_alloc(struct vrm_slab *s)
+{
+    void *ret = NULL;
+
+    if (s)
+    {
+        uint32_t flags = vrm_spin_irqsave(&(s->lock));
+
+        if (s->objs)
+            s->hits++;
+        else
+        {
+            s->misses++;
+            slab_grow(s);
+        }
+
+        ret = s->objs;
+        if (ret)
+        {
+            s->objs = *(void **)ret;
+            s->used++;
+        }
+
+        vrm_spin_irqrestore(&(s->lock), flags);
+    }
+
+    return ret;
+}
+
+extern void *
+vrm_slab_free(struct vrm_slab *s, void *obj)
+{
+    if (s && obj)
+    {
+        uint32_t flags = vrm_spin_irqsave(&(s->lock));
+        *(void **)obj = s->objs;
+        s->objs = obj;
+        s->used--;
+        vrm_spin_irqrestore(&(s->lock), flags);
+    }
+
+    return NULL;
+}
+
+extern struct vrm_slab *
+vrm_slab_walk(struct vrm_slab *s)
+{
+    uint32_t flags = vrm_spin_irqsave(&caches_lock);
+    struct vrm_slab *ret = (s) ? s->next : caches;
+    vrm_spin_irqrestore(&caches_lock, flags);
+
+    return ret;
+}
+
+extern bool
+vrm_slab_stat(struct vrm_slab *s, const char **name, size_t *size,
+              size_t *used, size_t *total, uint32_t *hits, uint32_t *misses)
+{
+    bool ret = (s != NULL);
+
+    if (ret)
+    {
+        if (name)
+            *name   = s->name;
+        if (size)
+            *size   = s->size;
+        if (used)
+            *used   = s->used;
+        if (total)
+            *total  = s->total;
+        if (hits)
+            *hits   = s->hits;
+        if (misses)
+            *misses = s->misses;
+    }
+
+    return ret;
+}
@@ -18,68 +18,147 @@
 #include <vermillion/util/str.h>
 #include <vermillion/util/types.h>
 
-extern size_t
-vrm_str_length(const char *str)
+/* Word-wide helpers */
+
+typedef uint32_t __attribute__((may_alias)) strword;
+
+#define WORD_ONES  0x01010101
+#define WORD_HIGHS 0x80808080
+#define WORD_ZERO(w) (((w) - WORD_ONES) & ~(w) & WORD_HIGHS)
+
+/* Aligned word reads never cross into an unmapped section */
+static const char *
+str_scan(const char *str, char c)
 {
-    return ((char*)vrm_mem_find(str, '\0', SIZE_MAX)) - str;
+    const uint8_t *s = (const uint8_t *)str;
+    uint8_t u = c;
+
+    while ((uint32_t)s & 3 && s[0] != '\0' && s[0] != u)
+        s = &(s[1]);
+
+    if (!((uint32_t)s & 3))
+    {
+        const strword *w = (const strword *)s;
+        if (u != '\0')
+        {
+            uint32_t pattern = u * WORD_ONES;
+            while (!WORD_ZERO(w[0]) && !WORD_ZERO(w[0] ^ pattern))
+                w = &(w[1]);
+        }
+        else
+        {
+            while (!WORD_ZERO(w[0]))
+                w = &(w[1]);
+        }
+        s = (const uint8_t *)w;
+    }
+
+    while (s[0] != '\0' && s[0] != u)
+        s = &(s[1]);
+
+    return (const char *)s;
 }
 
-extern int
-vrm_str_comp(const char *str, const char *str2, size_t length)
+/* Membership bitmap for character sets */
+
+struct strset
 {
-    length = (length != 0) ? length : SIZE_MAX;
-    size_t l = vrm_str_length(str);
-    size_t l2 = vrm_str_length(str2);
-    size_t ln = ((l < l2) ? l : l2) + 1;
-    return vrm_mem_comp(str, str2, (ln < length) ? ln : length);
+    uint32_t bits[256 / 32];
+};
+
+#define STRSET_HAS(set, c) ((set)->bits[(uint8_t)(c) >> 5] & \
+                            (1U << ((uint8_t)(c) & 31)))
+
+static void
+str_set(struct strset *set, const char *chars)
+{
+    vrm_mem_fill(set, 0, sizeof(struct strset));
+    for (const uint8_t *c = (const uint8_t *)chars; c[0] != '\0';
+         c = &(c[1]))
+        set->bits[c[0] >> 5] |= 1U << (c[0] & 31);
 }
 
-extern size_t
-vrm_str_span(const char *str, const char *chars, bool complement)
+static size_t
+str_skip(const char *str, const struct strset *set, bool complement)
 {
     size_t ret = 0;
 
-    size_t l = vrm_str_length(str);
-    size_t l2 = vrm_str_length(chars);
-    ret = l;
+    while (str[ret] != '\0' && (STRSET_HAS(set, str[ret]) != 0) != complement)
+        ret++;
+
+    return ret;
+}
+
+/* For external usage */
 
-    for (size_t i = 0; i < l; i++)
+extern size_t
+vrm_str_length(const char *str)
+{
+    return str_scan(str, '\0') - str;
+}
+
+extern int
+vrm_str_comp(const char *str, const char *str2, size_t length)
+{
+    int ret = 0;
+
+    const uint8_t *a = (const uint8_t *)str, *b = (const uint8_t *)str2;
+    length = (length != 0) ? length : SIZE_MAX;
+
+    /* Whole words while they match and hold no terminator */
+    if (!(((uint32_t)a ^ (uint32_t)b) & 3))
     {
-        bool has = false;
-        for (size_t j = 0; j < l2; j++)
+        for (; length && (uint32_t)a & 3; length--)
         {
-            if (str[i] == chars[j])
-            {
-                has = true;
+            if (a[0] != b[0] || a[0] == '\0')
                 break;
-            }
+            a = &(a[1]);
+            b = &(b[1]);
         }
 
-        if (complement)
-            has = !has;
+        if (length && !((uint32_t)a & 3))
+        {
+            const strword *wa = (const strword *)a, *wb = (const strword *)b;
+            while (length >= 4 && wa[0] == wb[0] && !WORD_ZERO(wa[0]))
+            {
+                wa = &(wa[1]);
+                wb = &(wb[1]);
+                length -= 4;
+            }
+            a = (const uint8_t *)wa;
+            b = (const uint8_t *)wb;
+        }
+    }
 
-        if (!has)
+    for (; length; length--)
+    {
+        if (a[0] != b[0] || a[0] == '\0')
         {
-            ret = i;
+            ret = a[0] - b[0];
             break;
         }
+        a = &(a[1]);
+        b = &(b[1]);
     }
 
     return ret;
 }
 
-extern char *
-vrm_str_find_l(const char *str, char c)
+extern size_t
+vrm_str_span(const char *str, const char *chars, bool complement)
 {
-    char *ret = NULL;
+    struct strset set;
+    str_set(&set, chars);
 
-    size_t l = vrm_str_length(str);
-    if (c != '\0')
-        ret = vrm_mem_find(str, c, l);
-    else
-        ret = (char*)&(str[l]);
+    return str_skip(str, &set, complement);
+}
 
-    return ret;
+extern char *
+vrm_str_find_l(const char *str, char c)
+{
+    /* The scan also stops at the end, which is no match unless sought */
+    const char *s = str_scan(str, c);
+    return (s[0] == c) ? (char *)s : NULL;
 }
 
 extern char *
@@ -87,20 +166,14 @@ vrm_str_find_r(const char *str, char c)
 {
     char *ret = NULL;
 
-    size_t l = vrm_str_length(str);
     if (c != '\0')
     {
-        for (size_t i = l; i > 0; i--)
-        {
-            if (str[i-1] == c)
-            {
-                ret = (char*)&(str[i-1]);
-                break;
-            }
-        }
+        for (const char *s = str_scan(str, c); s[0] != '\0';
+             s = str_scan(&(s[1]), c))
+            ret = (char *)s;
     }
     else
-        ret = (char*)&(str[l]);
+        ret = (char *)str_scan(str, '\0');
 
     return ret;
 }
@@ -122,14 +195,17 @@ vrm_str_find_s(const char *str, const char *str2)
 {
     char *ret = NULL;
 
-    size_t l = vrm_str_length(str);
     size_t l2 = vrm_str_length(str2);
-    for (size_t i = 0; i < l; i++)
+    if (l2 != 0)
     {
-        if (vrm_str_comp(&(str[i]), str2, l2) == 0)
+        for (const char *s = str_scan(str, str2[0]); s[0] != '\0';
+             s = str_scan(&(s[1]), str2[0]))
         {
-            ret = (char*)&(str[i]);
-            break;
+            if (vrm_str_comp(s, str2, l2) == 0)
+            {
+                ret = (char *)s;
+                break;
+            }
         }
     }
 
@@ -147,11 +223,14 @@ vrm_str_token(char *str, const char *chars, char **saveptr)
 
     if (state != NULL)
     {
-        state = &(state[vrm_str_span(state, chars, false)]);
+        struct strset set;
+        str_set(&set, chars);
+
+        state = &(state[str_skip(state, &set, false)]);
         if (state[0] != '\0')
         {
             ret = state;
-            state = &(state[vrm_str_span(state, chars, true)]);
+            state = &(state[str_skip(state, &set, true)]);
             if (state[0] != '\0')
             {
                 state[0] = '\0';